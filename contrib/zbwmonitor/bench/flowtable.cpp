@@ -0,0 +1,100 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Flow table throughput for several numbers of concurrent flows, with
+// room for all of them and with half the room (constant evictions)
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../flowtable.h"
+
+using namespace std;
+
+const unsigned int PACKETS = 8000000;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Counts the flows leaving the table
+class CountSink : public IFlowSink {
+  public:
+    CountSink() { flows = 0; }
+    void addFlow(const FlowStats *flow) { flows++; }
+    unsigned long flows;
+};
+
+static double run(vector<struct packet_info> &packets, unsigned int capacity,
+                  unsigned long *evicted) {
+    FlowTable table(capacity, 60, 1800);
+    CountSink sink;
+
+    double start = now();
+    for (unsigned int i = 0; i < PACKETS; i += PACKET_BATCH_SIZE) {
+        table.addBatch(&packets[i], PACKET_BATCH_SIZE, 1388534400, &sink);
+    }
+    double elapsed = now() - start;
+
+    *evicted = sink.flows;
+    return PACKETS / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int sizes[] = { 10000, 100000, 1000000 };
+
+    cout << setw(8) << "flows" << setw(12) << "full Mpps"
+         << setw(12) << "half Mpps" << setw(12) << "evicted" << endl;
+
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        unsigned int flows = sizes[s];
+
+        // Internal hosts talking to external servers, random source ports
+        srand(flows);
+        vector<struct packet_info> keys(flows);
+        for (unsigned int i = 0; i < flows; i++) {
+            struct packet_info *pkt = &keys[i];
+            pkt->ipv6 = false;
+            pkt->proto = 6;
+            pkt->sport = 1024 + rand() % 60000;
+            pkt->dport = 443;
+            pkt->weight = 1;
+            pkt->flowSampled = false;
+            mapIPv4(htonl(0x0a000000 + rand() % 65536), &pkt->src);
+            mapIPv4(htonl(0x50000000 + rand() % 65536), &pkt->dst);
+        }
+        vector<struct packet_info> packets(PACKETS);
+        for (unsigned int i = 0; i < PACKETS; i++) {
+            packets[i] = keys[rand() % flows];
+            packets[i].len = 64 + rand() % 1400;
+        }
+
+        unsigned long evictedFull, evictedHalf;
+        double full = run(packets, flows, &evictedFull);
+        double half = run(packets, flows / 2, &evictedHalf);
+
+        cout << setw(8) << flows << fixed << setprecision(2)
+             << setw(12) << full << setw(12) << half
+             << setw(12) << evictedHalf << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Host lookup microbenchmark: std::map (previous implementation) against
+// the open addressing HostTable, per packet cost for several host counts.
+// The last column is the table with half of the hosts being IPv6
+
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../bwstats.h"
+#include "../hosttable.h"
+
+using namespace std;
+
+const unsigned int PACKETS = 4000000;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Old BWStats::getHost
+static HostStats* mapGetHost(map<in_addr_t, HostStats*> &data, const struct in6_addr *ip) {
+    in_addr_t ip4;
+    memcpy(&ip4, ip->s6_addr + 12, 4);
+    map<in_addr_t, HostStats*>::iterator it = data.find(ip4);
+    if (it == data.end()) {
+        data[ip4] = new HostStats(ip);
+    }
+    return data[ip4];
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int sizes[] = { 1000, 10000, 50000, 200000 };
+
+    cout << setw(8) << "hosts" << setw(14) << "map ns/pkt"
+         << setw(14) << "table ns/pkt" << setw(10) << "speedup"
+         << setw(14) << "dual ns/pkt" << endl;
+
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        unsigned int hosts = sizes[s];
+
+        // Random packets from internal hosts in 10.0.0.0/8 to the outside
+        srand(hosts);
+        vector<struct packet_info> packets(PACKETS);
+        for (unsigned int i = 0; i < PACKETS; i++) {
+            struct packet_info *pkt = &packets[i];
+            pkt->ipv6 = false;
+            pkt->proto = 6;
+            pkt->len = 64 + rand() % 1400;
+            pkt->weight = 1;
+            pkt->flowSampled = false;
+            mapIPv4(htonl(0x0a000000 + rand() % hosts), &pkt->src);
+            mapIPv4(htonl(0x08080808), &pkt->dst);
+        }
+
+        map<in_addr_t, HostStats*> data;
+        double start = now();
+        for (unsigned int i = 0; i < PACKETS; i++) {
+            mapGetHost(data, &packets[i].src)->addExtPacket(&packets[i]);
+        }
+        double mapTime = now() - start;
+
+        HostTable table;
+        start = now();
+        for (unsigned int i = 0; i < PACKETS; i++) {
+            table.get(&packets[i].src)->addExtPacket(&packets[i]);
+        }
+        double tableTime = now() - start;
+
+        // Same traffic with half of the hosts in 2001:db8::/64
+        for (unsigned int i = 0; i < PACKETS; i += 2) {
+            struct in6_addr *src = &packets[i].src;
+            memset(src->s6_addr, 0, 16);
+            src->s6_addr[0] = 0x20;
+            src->s6_addr[1] = 0x01;
+            src->s6_addr[2] = 0x0d;
+            src->s6_addr[3] = 0xb8;
+            in_addr_t host = htonl(rand() % hosts);
+            memcpy(src->s6_addr + 12, &host, 4);
+            packets[i].ipv6 = true;
+        }
+        HostTable dual;
+        start = now();
+        for (unsigned int i = 0; i < PACKETS; i++) {
+            dual.get(&packets[i].src)->addExtPacket(&packets[i]);
+        }
+        double dualTime = now() - start;
+
+        cout << setw(8) << hosts << fixed << setprecision(1)
+             << setw(14) << mapTime * 1e9 / PACKETS
+             << setw(14) << tableTime * 1e9 / PACKETS
+             << setw(9) << mapTime / tableTime << "x"
+             << setw(14) << dualTime * 1e9 / PACKETS << endl;
+
+        for (map<in_addr_t, HostStats*>::iterator it = data.begin(); it != data.end(); it++) {
+            delete it->second;
+        }
+    }
+    return 0;
+}
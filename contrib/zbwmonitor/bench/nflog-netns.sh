@@ -0,0 +1,47 @@
+#!/bin/sh
+# NFLOG capture check in network namespaces (needs root, iproute2,
+# iptables and ping)
+#
+# Two namespaces joined by a veth pair, 10.99.0.1 (zbw-a) and
+# 10.99.0.2 (zbw-b). zbwmonitor runs in zbw-a reading the NFLOG group
+# its INPUT and OUTPUT rules log to, while 10 pings of 1000 bytes go
+# through. Both hosts must be dumped with INT_SENT=10000, INT_RECV=10000
+# and INT_ICMP=20000.
+
+ZBWMONITOR=${1:-./zbwmonitor}
+GROUP=99
+CONF=$(mktemp)
+
+cleanup() {
+    ip netns del zbw-a 2>/dev/null
+    ip netns del zbw-b 2>/dev/null
+    rm -f $CONF
+}
+trap cleanup EXIT
+set -e
+
+ip netns add zbw-a
+ip netns add zbw-b
+ip link add zbw-a netns zbw-a type veth peer name zbw-b netns zbw-b
+ip -n zbw-a addr add 10.99.0.1/24 dev zbw-a
+ip -n zbw-b addr add 10.99.0.2/24 dev zbw-b
+ip -n zbw-a link set zbw-a up
+ip -n zbw-b link set zbw-b up
+
+ip netns exec zbw-a iptables -A OUTPUT -o zbw-a -j NFLOG --nflog-group $GROUP
+ip netns exec zbw-a iptables -A INPUT -i zbw-a -j NFLOG --nflog-group $GROUP
+
+cat > $CONF <<CONF
+capture = "nflog";
+nflog_groups = [ $GROUP ];
+dump_rate = 5;
+metrics = false;
+internal_networks = ( "10.99.0.0/24" );
+CONF
+
+ip netns exec zbw-a $ZBWMONITOR $CONF &
+PID=$!
+sleep 1
+ip netns exec zbw-a ping -q -c 10 -i 0.2 -s 972 10.99.0.2 > /dev/null
+sleep 6
+kill $PID
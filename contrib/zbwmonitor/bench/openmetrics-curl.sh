@@ -0,0 +1,89 @@
+#!/bin/sh
+# OpenMetrics endpoint check with curl in network namespaces (needs root,
+# iproute2, iptables, ping and curl)
+#
+# Same namespaces as nflog-netns.sh: 10 pings of 1000 bytes go from
+# 10.99.0.1 (zbw-a) to 10.99.0.2 (zbw-b), twice. Two zbwmonitor run in
+# zbw-a, each reading its own NFLOG group, one listening on
+# 127.0.0.1:9102 and the other on a unix socket. On both listeners:
+# - GET /metrics has the OpenMetrics content type and ends with # EOF
+# - 10.99.0.1 sent 10000 bytes after the first pings and 20000 after
+#   the second ones, dump periods later (the counters carry over)
+# - unknown paths get a 404
+
+ZBWMONITOR=${1:-./zbwmonitor}
+DIR=$(mktemp -d)
+SOCKET=$DIR/metrics.sock
+PIDS=
+FAILED=0
+
+cleanup() {
+    [ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+    ip netns del zbw-a 2>/dev/null
+    ip netns del zbw-b 2>/dev/null
+    rm -rf $DIR
+}
+trap cleanup EXIT
+set -e
+
+ip netns add zbw-a
+ip netns add zbw-b
+ip link add zbw-a netns zbw-a type veth peer name zbw-b netns zbw-b
+ip -n zbw-a addr add 10.99.0.1/24 dev zbw-a
+ip -n zbw-b addr add 10.99.0.2/24 dev zbw-b
+ip -n zbw-a link set lo up
+ip -n zbw-a link set zbw-a up
+ip -n zbw-b link set zbw-b up
+
+# Start a zbwmonitor in zbw-a reading NFLOG group $1, serving on $2
+start() {
+    ip netns exec zbw-a iptables -A OUTPUT -o zbw-a -j NFLOG --nflog-group $1
+    ip netns exec zbw-a iptables -A INPUT -i zbw-a -j NFLOG --nflog-group $1
+    cat > $DIR/$1.conf <<CONF
+capture = "nflog";
+nflog_groups = [ $1 ];
+dump_rate = 2;
+openmetrics_listen = "$2";
+openmetrics_rate = 1;
+metrics = false;
+internal_networks = ( "10.99.0.0/24" );
+CONF
+    ip netns exec zbw-a $ZBWMONITOR $DIR/$1.conf > /dev/null &
+    PIDS="$PIDS $!"
+}
+
+fail() {
+    echo "FAIL: $*"
+    FAILED=1
+}
+
+# Scrape listener $1 with curl options $2 at $3, 10.99.0.1 must have
+# sent $4 bytes
+check() {
+    ip netns exec zbw-a curl -s $2 -D $DIR/headers -o $DIR/body $3/metrics || fail "$1: no answer"
+    grep -qi "^Content-Type: application/openmetrics-text" $DIR/headers || fail "$1: content type"
+    [ "$(tail -n 1 $DIR/body)" = "# EOF" ] || fail "$1: no # EOF"
+    grep -q "^zbwmonitor_host_sent_bytes_total{host=\"10.99.0.1\",traffic=\"internal\"} $4\$" $DIR/body ||
+        fail "$1: 10.99.0.1 did not send $4 bytes"
+    code=$(ip netns exec zbw-a curl -s $2 -o /dev/null -w "%{http_code}" $3/none)
+    [ "$code" = 404 ] || fail "$1: $code on an unknown path"
+}
+
+start 99 127.0.0.1:9102
+start 98 $SOCKET
+sleep 1
+
+ip netns exec zbw-a ping -q -c 10 -i 0.2 -s 972 10.99.0.2 > /dev/null
+sleep 2.5
+check tcp "" http://127.0.0.1:9102 10000
+check unix "--unix-socket $SOCKET" http://localhost 10000
+
+ip netns exec zbw-a ping -q -c 10 -i 0.2 -s 972 10.99.0.2 > /dev/null
+sleep 2.5
+check tcp "" http://127.0.0.1:9102 20000
+check unix "--unix-socket $SOCKET" http://localhost 20000
+
+if [ $FAILED = 0 ]; then
+    echo "OK"
+fi
+exit $FAILED
@@ -0,0 +1,198 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Synthetic traffic generator for zbwmonitor --replay
+//
+// Writes a pcap file with N internal hosts spread across M internal
+// networks (10.M.0.0/16 and 2001:db8:M::/48) talking to external peers
+// and to each other, and prints a matching zbwmonitor config to stdout.
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <netinet/ether.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+using namespace std;
+
+// Only headers are written, zbwmonitor never looks further
+const unsigned int SNAPLEN = 128;
+
+// Start of the capture and packets per second
+const uint32_t START_TIME = 1388534400;
+const unsigned int RATE = 1000000;
+
+struct pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_header {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+static void usage(const char *name) {
+    cerr << "Usage: " << name << " file.pcap packets hosts networks [ipv6%]" << endl;
+    exit(1);
+}
+
+// Internal host address (IPv4 or IPv6) for host number n
+static void internalHost(unsigned int n, unsigned int networks, bool ipv6, u_char *addr) {
+    unsigned int net = n % networks;
+    unsigned int host = n / networks + 1;
+
+    if (ipv6) {
+        memset(addr, 0, 16);
+        addr[0] = 0x20; addr[1] = 0x01; addr[2] = 0x0d; addr[3] = 0xb8;
+        addr[5] = net;
+        addr[12] = host >> 24; addr[13] = host >> 16;
+        addr[14] = host >> 8;  addr[15] = host;
+    } else {
+        uint32_t ip = htonl(0x0a000000 | (net << 16) | (host & 0xffff));
+        memcpy(addr, &ip, 4);
+    }
+}
+
+// Random external address
+static void externalHost(bool ipv6, u_char *addr) {
+    if (ipv6) {
+        memset(addr, 0, 16);
+        addr[0] = 0x2a; addr[1] = 0x00;
+        for (int i = 8; i < 16; i++) addr[i] = rand();
+    } else {
+        uint32_t ip = htonl(0x50000000 + rand() % 0x20000000);
+        memcpy(addr, &ip, 4);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 5 || argc > 6) usage(argv[0]);
+
+    const char *file = argv[1];
+    unsigned long packets = strtoul(argv[2], NULL, 10);
+    unsigned int hosts = atoi(argv[3]);
+    unsigned int networks = atoi(argv[4]);
+    unsigned int ipv6share = argc == 6 ? atoi(argv[5]) : 0;
+    if (hosts == 0 || networks == 0 || networks > 256 || hosts / networks >= 0xffff) {
+        usage(argv[0]);
+    }
+
+    FILE *out = fopen(file, "wb");
+    if (out == NULL) {
+        perror(file);
+        return 1;
+    }
+
+    struct pcap_file_header fh;
+    fh.magic = 0xa1b2c3d4;
+    fh.version_major = 2;
+    fh.version_minor = 4;
+    fh.thiszone = 0;
+    fh.sigfigs = 0;
+    fh.snaplen = SNAPLEN;
+    fh.linktype = 1; // Ethernet
+    fwrite(&fh, sizeof(fh), 1, out);
+
+    u_char frame[SNAPLEN];
+    srand(hosts ^ networks);
+    for (unsigned long i = 0; i < packets; i++) {
+        memset(frame, 0, sizeof(frame));
+        bool ipv6 = (unsigned int) (rand() % 100) < ipv6share;
+
+        // 70% TCP, 25% UDP, 5% ICMP
+        int r = rand() % 100;
+        unsigned char proto = r < 70 ? IPPROTO_TCP : (r < 95 ? IPPROTO_UDP : IPPROTO_ICMP);
+        if (ipv6 && proto == IPPROTO_ICMP) proto = IPPROTO_ICMPV6;
+        unsigned int l4len = proto == IPPROTO_TCP ? sizeof(struct tcphdr) : 8;
+        unsigned int iplen = ipv6 ? sizeof(struct ip6_hdr) : sizeof(struct ip);
+        unsigned int payload = rand() % 1400;
+
+        // 45% upload, 45% download, 10% internal to internal
+        u_char local[16], remote[16];
+        internalHost(rand() % hosts, networks, ipv6, local);
+        r = rand() % 100;
+        if (r < 10) internalHost(rand() % hosts, networks, ipv6, remote);
+        else        externalHost(ipv6, remote);
+        u_char *src = r < 55 ? local : remote;
+        u_char *dst = r < 55 ? remote : local;
+
+        struct ether_header *eth = (struct ether_header*) frame;
+        eth->ether_type = htons(ipv6 ? ETHERTYPE_IPV6 : ETHERTYPE_IP);
+        u_char *l3 = frame + sizeof(struct ether_header);
+
+        if (ipv6) {
+            struct ip6_hdr *ip6 = (struct ip6_hdr*) l3;
+            ip6->ip6_flow = htonl(0x60000000);
+            ip6->ip6_plen = htons(l4len + payload);
+            ip6->ip6_nxt = proto;
+            ip6->ip6_hlim = 64;
+            memcpy(&ip6->ip6_src, src, 16);
+            memcpy(&ip6->ip6_dst, dst, 16);
+        } else {
+            struct ip *ip = (struct ip*) l3;
+            ip->ip_v = 4;
+            ip->ip_hl = 5;
+            ip->ip_len = htons(iplen + l4len + payload);
+            ip->ip_ttl = 64;
+            ip->ip_p = proto;
+            memcpy(&ip->ip_src, src, 4);
+            memcpy(&ip->ip_dst, dst, 4);
+        }
+
+        u_char *l4 = l3 + iplen;
+        uint16_t sport = htons(1024 + rand() % 60000);
+        uint16_t dport = htons(r % 2 ? 443 : 53);
+        memcpy(l4, &sport, 2);
+        memcpy(l4 + 2, &dport, 2);
+
+        struct pcap_record_header rh;
+        rh.ts_sec = START_TIME + i / RATE;
+        rh.ts_usec = i % RATE;
+        rh.caplen = sizeof(struct ether_header) + iplen + l4len;
+        rh.len = rh.caplen + payload;
+        fwrite(&rh, sizeof(rh), 1, out);
+        fwrite(frame, rh.caplen, 1, out);
+    }
+    fclose(out);
+
+    // Matching config
+    cout << "dump_rate = 600;" << endl;
+    cout << "hosts_capacity = " << hosts << ";" << endl;
+    cout << "internal_networks = (" << endl;
+    for (unsigned int n = 0; n < networks; n++) {
+        cout << "    \"10." << n << ".0.0/16\"";
+        if (ipv6share > 0) cout << ",\n    \"2001:db8:" << hex << n << dec << "::/48\"";
+        cout << (n + 1 < networks ? "," : "") << endl;
+    }
+    cout << ");" << endl;
+
+    return 0;
+}
@@ -15,13 +15,41 @@
    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 #include <iostream>
+#include <string>
+#include <vector>
 #include <pcap.h>
 #include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <netinet/ether.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
 #include "bwstats.h"
+#include "packet.h"
+#include "linklayer.h"
+#include "classifier.h"
+#include "flowtable.h"
+#include "sampling.h"
 #include "dumpers/console.h"
+#include "dumpers/json.h"
+#include "dumpers/binary.h"
+#include "dumpers/shm.h"
+#include "dumpers/openmetrics.h"
+#include "dumpers/checkpoint.h"
+#include "dumpers/ipfix.h"
+#include "capture/pcap.h"
+#include "capture/ring.h"
+#include "capture/replay.h"
+#include "capture/nflog.h"
+#include "collector.h"
+#include "metrics.h"
 #include <libconfig.h>
 
 #define DEBUG 0
@@ -33,60 +61,281 @@ char ERROR_BUF[PCAP_ERRBUF_SIZE];
 // Miliseconds between packets copy op from kernel
 const int TO_MS = 1000;
 
-// Packet capture size (big enough to decode headers)
-const int CAPTURE_SIZE = 64;
+// Packet capture size, the longest link layer and IP headers decoded
+const int CAPTURE_SIZE = LINK_MAX_HDR_LEN + IP_CAPTURE_SIZE;
+
+// Kernel filter, only IP traffic to or from the internal networks is
+// accounted (see buildFilters). On Ethernet it may come inside VLAN tags
+// or PPPoE sessions, those frames go through unfiltered
+const char *TAGGED_FILTER = "ether proto 0x8100 or ether proto 0x88a8 "
+                            "or ether proto 0x9100 or ether proto 0x8864";
+const char *IP_FILTER = "ip or ip6";
+
+// Only let the internal networks traffic through the kernel filter
+bool KERNEL_FILTER = true;
 
 // Dump stats each X seconds
 int DUMP_RATE = 600;
 
-// Global packet stats
-BWStats stats;
+// Seconds between IPFIX templates resends
+int IPFIX_TEMPLATE_REFRESH = 600;
+
+// Live stats shared memory segment (optional), seconds between updates
+// and max number of hosts
+const char *LIVE_STATS = NULL;
+int LIVE_RATE = 1;
+int LIVE_HOSTS = 65536;
+
+// OpenMetrics endpoint (optional), seconds between updates
+const char *OPENMETRICS_LISTEN = NULL;
+int OPENMETRICS_RATE = 10;
+
+// Checkpoint file of the current period (optional), seconds between
+// checkpoints and max number of hosts
+const char *CHECKPOINT_FILE = NULL;
+int CHECKPOINT_RATE = 60;
+int CHECKPOINT_HOSTS = 65536;
+
+// Per host rates (peak, average, 95th percentile), seconds per sample
+bool HOST_RATES = false;
+int RATE_INTERVAL = 1;
+
+// Seconds between shard handovers to the collector (epoch length), the
+// dump rate or the live stats / checkpoint / rates interval. Both are the
+// startup values: a reload publishes its own in the epoch clock
+int TICK = 600;
+
+// Hosts to preallocate room for in the stats tables
+int HOSTS_CAPACITY = 0;
+
+// Only keep the top X hosts by traffic (0 keeps all of them)
+int TOP_HOSTS = 0;
+
+// Max hosts in the stats between dumps, idle ones are evicted, and in a
+// capture shard (0 means no limit)
+int MAX_HOSTS = 0;
+
+// Flows tracked by each capture thread (0 disables flow accounting)
+int FLOW_CAPACITY = 0;
+
+// Seconds without packets for a flow to expire
+int FLOW_IDLE_TIMEOUT = 60;
+
+// Seconds between reports of long lived flows
+int FLOW_ACTIVE_TIMEOUT = 1800;
+
+// Packet sampling (optional): random or by flow, 1 in SAMPLING_RATE
+// packets accounted, flow hashes salt
+sampling_mode SAMPLING_MODE = SAMPLING_NONE;
+int SAMPLING_RATE = 1;
+uint64_t SAMPLING_SALT = 0;
+
+// Device to capture from, and the direction of the packets accounted
+struct device {
+    const char *name;
+    capture_direction direction;
+};
+
+// Internal networks, their classifier and kernel filters. Published to
+// the capture threads RCU style: a reload builds a new one and swaps the
+// pointer, the old one is freed once all of them moved on (see
+// waitGracePeriod)
+struct net_config {
+    NetClassifier nets;
 
-// Dump result (by now here, of course this is dummy)
-ConsoleBWStatsDumper dumper;
+    // Internal networks as filter expressions, per family, and the
+    // filters of Ethernet and other links
+    string ipNets;
+    string ip6Nets;
+    string filter;
+    string etherFilter;
+};
 
+// Epochs of tick seconds since start, numbered from base, and dump
+// periods of dumpTicks epochs (published the same way)
+struct epoch_clock {
+    time_t start;
+    unsigned int base;
+    unsigned int tick;
+    unsigned int dumpTicks;
+};
 
-// Process a packet, update counters and store valuable info
-void processPkt(u_char *useless, const struct pcap_pkthdr* pkthdr, const u_char* packet)
+// Capture worker, each one feeds its own stats shard
+struct worker {
+    int id;
+    ICapture *capture;
+    pcap_handler handler;
+    BWStats *stats;
+    FlowTable *flows;
+    unsigned int epoch;
+    pthread_t thread;
+
+    // Decoded packets waiting to be accounted
+    struct packet_info batch[PACKET_BATCH_SIZE];
+    unsigned int batched;
+
+    // Capture time of the last packet
+    time_t lastSeen;
+
+    // Packet sampling (rate 1 accounts all of them)
+    Sampler sampler;
+
+    // Self instrumentation counters, capture statistics last update
+    struct capture_metrics *metrics;
+    time_t statsTime;
+
+    // Internal networks in use, and capturePkts calls done
+    const struct net_config *nets;
+    unsigned long passes;
+};
+
+// Capture workers
+vector<worker*> workers;
+
+// Internal networks and epoch clock, shared by all the workers (see
+// net_config)
+struct net_config *netConfig;
+struct epoch_clock *epochClock;
+
+// Subnet rollups of the internal networks, shared by all the stats
+SubnetLayout subnetLayout;
+
+// Dump result
+IBWStatsDumper *dumper;
+
+// Merges and dumps the workers stats in background
+StatsCollector *collector;
+
+// Start of the first dump period
+time_t startTime;
+
+// Self instrumentation
+Metrics metrics;
+
+
+// Account the batched packets of a worker
+void flushBatch(worker *w)
 {
+    struct capture_metrics *m = w->metrics;
+    uint64_t start = readCycles();
+    for (unsigned int i = 0; i < w->batched; i++) {
+        w->stats->addPacket(&w->batch[i]);
+    }
+    uint64_t hostsDone = readCycles();
+    m->hostCycles += hostsDone - start;
+    if (w->flows) {
+        w->flows->addBatch(w->batch, w->batched, w->lastSeen, w->stats);
+        m->flowCycles += readCycles() - hostsDone;
+    }
+    m->accounted += w->batched;
+    w->batched = 0;
+
+    // Full shard (max_hosts, or as many finished flows as the flow table
+    // holds), handed over early: the collector merges it into the same
+    // epoch, evicting and dumping the flows from there
+    if ((TOP_HOSTS == 0 && MAX_HOSTS > 0 && w->stats->hostCount() >= (unsigned int) MAX_HOSTS) ||
+        (w->flows && w->stats->flowCount() >= w->flows->capacity())) {
+        w->stats = collector->swap(w->id, w->stats, w->epoch, w->epoch);
+        w->stats->setInternalNets(&w->nets->nets);
+    }
+}
+
+// Update the capture statistics and flow table usage of a worker
+void updateStats(worker *w)
+{
+    struct capture_stats st;
+    if (w->capture->getStats(&st)) {
+        w->metrics->kernelRecv = st.received;
+        w->metrics->kernelDrops = st.dropped;
+        w->metrics->ifDrops = st.ifDropped;
+    }
+    if (w->flows) {
+        w->metrics->flows = w->flows->size();
+        w->metrics->flowCapacity = w->flows->capacity();
+    }
+}
+
+// Process a packet of the given link type, decode it and queue it in
+// the worker batch
+template <int DLT>
+void processPkt(u_char *user, const struct pcap_pkthdr* pkthdr, const u_char* packet)
+{
+    worker *w = (worker*) user;
+    struct packet_info &info = w->batch[w->batched];
+    struct capture_metrics *m = w->metrics;
+
+    w->lastSeen = pkthdr->ts.tv_sec;
+
+    m->packets++;
+
+    // Random sampling drops packets before decoding them
+    if (w->sampler.getMode() == SAMPLING_RANDOM && w->sampler.skip()) return;
+
+    // Decoding cost is measured on a sample of the packets
+    bool sample = (m->packets & (METRICS_SAMPLE_RATE - 1)) == 0;
+    uint64_t start = sample ? readCycles() : 0;
+
+#if DEBUG
     static int count = 1;
-    static int lastDump = time(NULL);
     count++;
+    const struct ether_header *eth = (const struct ether_header*) packet;
+#endif
 
-    if ((time(NULL) - lastDump) > DUMP_RATE) {
-        // Dump current status
-        // This should not take too long
-        // if it does some problems will appear (packet loss)
-        stats.dump(&dumper);
-        stats.clear();
-        lastDump = time(NULL);
+    unsigned int caplen = pkthdr->caplen;
+    if (!decodeLink<DLT>(packet, caplen, &info)) {
+        m->nonIP++;
+        return;
     }
 
-    //const struct ether_header *eth;
-    const struct ip *ip;
-    //eth = (const struct ether_header*) packet;
-    packet += sizeof(struct ether_header);
-    ip = (const struct ip*) packet;
+    bool decoded;
+    switch (packet[0] >> 4) {
+        case 4:
+            decoded = decodeIPv4(packet, caplen, &info);
+            break;
+        case 6:
+            decoded = decodeIPv6(packet, caplen, &info);
+            break;
+        default:
+            m->nonIP++;
+            return;
+    }
+    if (!decoded) {
+        m->truncated++;
+        return;
+    }
 
-    if (ip->ip_v != 4) return; // TODO IPv6 support
+    if (w->sampler.getMode() == SAMPLING_FLOW && !w->sampler.sampleFlow(&info)) return;
+    info.weight = w->sampler.getRate();
+    info.flowSampled = w->sampler.getMode() == SAMPLING_FLOW;
+
+    if (sample) {
+        m->decodeCycles += readCycles() - start;
+        m->decodeSamples++;
+    }
 
-    stats.addPacket(ip);
+    if (++w->batched == PACKET_BATCH_SIZE) flushBatch(w);
 
 #if DEBUG
-    char src_ip[INET_ADDRSTRLEN];
-    char dst_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(ip->ip_src), src_ip, INET_ADDRSTRLEN);
-    inet_ntop(AF_INET, &(ip->ip_dst), dst_ip, INET_ADDRSTRLEN);
+    char src_ip[INET6_ADDRSTRLEN];
+    char dst_ip[INET6_ADDRSTRLEN];
+    if (info.ipv6) {
+        inet_ntop(AF_INET6, &(info.src), src_ip, INET6_ADDRSTRLEN);
+        inet_ntop(AF_INET6, &(info.dst), dst_ip, INET6_ADDRSTRLEN);
+    } else {
+        inet_ntop(AF_INET, info.src.s6_addr + 12, src_ip, INET6_ADDRSTRLEN);
+        inet_ntop(AF_INET, info.dst.s6_addr + 12, dst_ip, INET6_ADDRSTRLEN);
+    }
 
     cout << "Counter: " << count << endl;
     cout << "MAC source: " << ether_ntoa((const ether_addr*)eth->ether_shost) << endl;
     cout << "MAC dest: " << ether_ntoa((const ether_addr*)eth->ether_dhost) << endl;
-    cout << "IP version: " << ip->ip_v << endl;
+    cout << "VLAN: " << info.vlan << endl;
+    cout << "IP version: " << (info.ipv6 ? 6 : 4) << endl;
     cout << "IP src: " << src_ip << endl;
     cout << "IP dest: " << dst_ip << endl;
-    cout << "Size: " << ntohs(ip->ip_len) << endl;
+    cout << "Size: " << info.len << endl;
     cout << "Protocol: ";
-    switch (ip->ip_p) {
+    switch (info.proto) {
         case 6:
             cout << "TCP";
             break;
@@ -94,6 +343,7 @@ void processPkt(u_char *useless, const struct pcap_pkthdr* pkthdr, const u_char*
             cout << "UDP";
             break;
         case 1:
+        case 58:
             cout << "ICMP";
             break;
         default:
@@ -104,13 +354,598 @@ void processPkt(u_char *useless, const struct pcap_pkthdr* pkthdr, const u_char*
 #endif //DEBUG
 }
 
+// returns the packet handler for the given link type, NULL if it is
+// not supported
+pcap_handler linkHandler(int dlt)
+{
+    switch (dlt) {
+        case DLT_EN10MB:     return processPkt<DLT_EN10MB>;
+        case DLT_LINUX_SLL:  return processPkt<DLT_LINUX_SLL>;
+        case DLT_LINUX_SLL2: return processPkt<DLT_LINUX_SLL2>;
+        case DLT_PPP_ETHER:  return processPkt<DLT_PPP_ETHER>;
+        case DLT_RAW:        return processPkt<DLT_RAW>;
+        default:             return NULL;
+    }
+}
+
+// Epoch of the given time. Times before the clock start belong to the
+// epoch before base (reloads publish the clock ahead of time)
+unsigned int epochAt(const struct epoch_clock *clock, time_t now)
+{
+    if (now < clock->start) return clock->base > 0 ? clock->base - 1 : 0;
+    return clock->base + (now - clock->start) / clock->tick;
+}
+
+// Install the kernel filter of the internal networks in a capture, or
+// one letting all IP through if the kernel refuses it
+bool setCaptureFilter(ICapture *capture, const struct net_config *nets)
+{
+    bool ether = capture->datalink() == DLT_EN10MB;
+    if (capture->setFilter((ether ? nets->etherFilter : nets->filter).c_str())) return true;
+
+    // Too many internal networks for the kernel, let all IP through
+    cerr << "Cannot set the internal networks filter, capturing all IP traffic" << endl;
+    string all = IP_FILTER;
+    if (ether) all = all + " or " + TAGGED_FILTER;
+    return capture->setFilter(all.c_str());
+}
+
+// Switch a worker to the given internal networks
+void useNets(worker *w, const struct net_config *nets)
+{
+    if (w->nets == NULL || w->nets->filter != nets->filter) setCaptureFilter(w->capture, nets);
+    w->nets = nets;
+    w->stats->setInternalNets(&nets->nets);
+}
+
+// Capture a batch of packets, returns the dispatch result
+int capturePkts(worker *w)
+{
+    // Reloaded internal networks are picked up between batches
+    const struct net_config *nets = __atomic_load_n(&netConfig, __ATOMIC_SEQ_CST);
+    if (nets != w->nets) useNets(w, nets);
+
+    int res = w->capture->dispatch(w->handler, (u_char*) w);
+    if (res < 0) return res;
+    flushBatch(w);
+
+    // Dump period finished, hand over the shard and get a new one
+    // (the dump is done by the collector, capture goes on meanwhile)
+    // Packets carry their capture time, only ask the clock when idle
+    time_t now = res > 0 ? w->lastSeen : time(NULL);
+    if (startTime == 0) startTime = epochClock->start = now; // replays start with the first packet
+    if (w->flows) w->flows->expire(now, w->stats);
+    if (now != w->statsTime) {
+        updateStats(w);
+        w->statsTime = now;
+    }
+
+    unsigned int epoch = epochAt(__atomic_load_n(&epochClock, __ATOMIC_SEQ_CST), now);
+    if (epoch > w->epoch) {
+        w->stats = collector->swap(w->id, w->stats, w->epoch, epoch);
+        w->stats->setInternalNets(&w->nets->nets);
+        w->epoch = epoch;
+    }
+
+    // Done with the current config (see waitGracePeriod)
+    __atomic_store_n(&w->passes, w->passes + 1, __ATOMIC_SEQ_CST);
+    return res;
+}
+
+// Capture thread main loop
+void *captureThread(void *arg)
+{
+    worker *w = (worker*) arg;
+
+    for (;;) {
+        if (capturePkts(w) < 0) {
+            cerr << "Capture failed, exiting" << endl;
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+// Add a network to the filter expressions, host bits cleared (pcap
+// refuses them)
+void addFilterNet(struct net_config *conf, int family, const struct in6_addr *addr, int len)
+{
+    struct in6_addr net = *addr;
+    int bytes = family == AF_INET6 ? 16 : 4;
+    for (int i = 0; i < bytes; i++) {
+        int bits = len - i * 8;
+        if (bits <= 0) net.s6_addr[i] = 0;
+        else if (bits < 8) net.s6_addr[i] &= 0xff << (8 - bits);
+    }
+
+    char ip[INET6_ADDRSTRLEN];
+    char expr[INET6_ADDRSTRLEN + 16];
+    inet_ntop(family, &net, ip, INET6_ADDRSTRLEN);
+    snprintf(expr, sizeof(expr), "net %s/%d", ip, len);
+
+    string &nets = family == AF_INET6 ? conf->ip6Nets : conf->ipNets;
+    if (!nets.empty()) nets += " or ";
+    nets += expr;
+}
+
+// Kernel filters: IP packets from or to the internal networks if
+// internalOnly is set (transit traffic between external hosts is never
+// accounted), all the IP packets otherwise
+void buildFilters(struct net_config *conf, bool internalOnly)
+{
+    const string &ipNets = conf->ipNets;
+    const string &ip6Nets = conf->ip6Nets;
+    string &filter = conf->filter;
+
+    if (internalOnly && (!ipNets.empty() || !ip6Nets.empty())) {
+        filter = "";
+        if (!ipNets.empty()) filter = "(ip and (" + ipNets + "))";
+        if (!ipNets.empty() && !ip6Nets.empty()) filter += " or ";
+        if (!ip6Nets.empty()) filter += "(ip6 and (" + ip6Nets + "))";
+    } else {
+        filter = IP_FILTER;
+    }
+    conf->etherFilter = filter + " or " + TAGGED_FILTER;
+}
+
+// Create a capture worker of the packets going in the given direction,
+// returns NULL if the capture cannot be started
+worker *newWorker(ICapture *capture, capture_direction direction)
+{
+    if (!capture->open()) {
+        delete capture;
+        return NULL;
+    }
+
+    int dlt = capture->datalink();
+    pcap_handler handler = linkHandler(dlt);
+    if (handler == NULL) {
+        const char *name = pcap_datalink_val_to_name(dlt);
+        cerr << "Unsupported link type " << (name ? name : "") << " (" << dlt << ")" << endl;
+        delete capture;
+        return NULL;
+    }
+    if (!setCaptureFilter(capture, netConfig)) {
+        delete capture;
+        return NULL;
+    }
+    if (direction != CAPTURE_BOTH && !capture->setDirection(direction)) {
+        cerr << "Cannot capture a single direction" << endl;
+        delete capture;
+        return NULL;
+    }
+
+    worker *w = new worker;
+    w->id = collector->addWorker();
+    w->capture = capture;
+    w->handler = handler;
+    w->metrics = metrics.addCapture();
+    w->statsTime = 0;
+    w->stats = collector->getShard();
+    w->nets = netConfig;
+    w->stats->setInternalNets(&netConfig->nets);
+    w->passes = 0;
+    w->flows = NULL;
+    if (FLOW_CAPACITY > 0) {
+        w->flows = new FlowTable(FLOW_CAPACITY, FLOW_IDLE_TIMEOUT, FLOW_ACTIVE_TIMEOUT);
+    }
+    w->epoch = 0;
+    w->batched = 0;
+    w->lastSeen = startTime;
+    w->sampler.setup(SAMPLING_MODE, SAMPLING_RATE, SAMPLING_SALT, SAMPLING_SALT + w->id);
+    workers.push_back(w);
+    return w;
+}
+
+// Start a new capture worker thread
+bool startWorker(ICapture *capture, capture_direction direction)
+{
+    worker *w = newWorker(capture, direction);
+    if (w == NULL) return false;
+
+    if (pthread_create(&w->thread, NULL, captureThread, w) != 0) {
+        cerr << "Cannot create capture thread" << endl;
+        workers.pop_back();
+        collector->removeWorker(w->id, w->stats);
+        metrics.removeCapture(w->metrics);
+        delete w->flows;
+        delete w->capture;
+        delete w;
+        return false;
+    }
+    return true;
+}
+
+// Start the capture threads of a device: threads rings in the given
+// fanout group, or libpcap if the ring cannot be set up
+bool startDevice(const struct device *dev, const char *method, int threads, int fanout)
+{
+    const char *dirs[] = { "both", "in", "out" };
+    cout << "Listening on " << dev->name << " (direction " << dirs[dev->direction] << ")" << endl;
+
+    unsigned int started = workers.size();
+    if (strcmp(method, "ring") == 0) {
+        // One ring per thread, all of them in the same fanout group
+        for (int t = 0; t < threads; t++) {
+            ICapture *capture = new RingCapture(dev->name, CAPTURE_SIZE, TO_MS, fanout);
+            if (!startWorker(capture, dev->direction)) break;
+        }
+        if (workers.size() == started) {
+            cerr << "Ring capture not available on " << dev->name << ", falling back to libpcap" << endl;
+        }
+    }
+
+    if (workers.size() == started) {
+        ICapture *capture = new PcapCapture(dev->name, CAPTURE_SIZE, TO_MS);
+        if (!startWorker(capture, dev->direction)) {
+            cerr << "Error opening " << dev->name << ". Are you root?" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parse a device to capture from, "name" string or { dev = "name";
+// direction = "in" | "out" | "both"; } group, and add it to devices
+bool addDevice(config_setting_t *setting, vector<struct device> *devices)
+{
+    struct device dev;
+    const char *direction = "both";
+
+    if (config_setting_type(setting) == CONFIG_TYPE_STRING) {
+        dev.name = config_setting_get_string(setting);
+    } else if (!config_setting_is_group(setting) ||
+               !config_setting_lookup_string(setting, "dev", &dev.name)) {
+        cerr << "Wrong device, use \"name\" or { dev = \"name\"; direction = \"in\"; }" << endl;
+        return false;
+    } else {
+        config_setting_lookup_string(setting, "direction", &direction);
+    }
+
+    if (strcmp(direction, "both") == 0) {
+        dev.direction = CAPTURE_BOTH;
+    } else if (strcmp(direction, "in") == 0) {
+        dev.direction = CAPTURE_IN;
+    } else if (strcmp(direction, "out") == 0) {
+        dev.direction = CAPTURE_OUT;
+    } else {
+        cerr << "Unknown direction " << direction << " for " << dev.name << ", use in, out or both" << endl;
+        return false;
+    }
+
+    // The same packets would be accounted twice
+    for (unsigned int i = 0; i < devices->size(); i++) {
+        if (strcmp((*devices)[i].name, dev.name) == 0) {
+            cerr << "Device " << dev.name << " listed twice" << endl;
+            return false;
+        }
+    }
+    devices->push_back(dev);
+    return true;
+}
+
+// Parse an internal network, "ip/len" string (IPv4 or IPv6) or
+// ("ip", "mask") pair (IPv4), and add it to the internal networks of conf
+// (and layout, if set)
+bool addInternalNet(config_setting_t *network, int index, struct net_config *conf,
+                    SubnetLayout *layout)
+{
+    const char *ip;
+    int len;
+    char addr[INET6_ADDRSTRLEN];
+
+    if (config_setting_type(network) == CONFIG_TYPE_STRING) {
+        // CIDR notation
+        const char *cidr = config_setting_get_string(network);
+        const char *slash = strchr(cidr, '/');
+        if (slash == NULL || slash - cidr >= INET6_ADDRSTRLEN) {
+            cerr << "Wrong network " << cidr << ", use ip/len" << endl;
+            return false;
+        }
+        strncpy(addr, cidr, slash - cidr);
+        addr[slash - cidr] = '\0';
+        ip = addr;
+
+        // Digits only, "ip/", "ip/abc" or "ip/ 8" must not become /0
+        char *end;
+        long prefix = strtol(slash + 1, &end, 10);
+        if (!isdigit(slash[1]) || *end != '\0' || prefix > 128) {
+            cerr << "Wrong network " << cidr << ", use ip/len" << endl;
+            return false;
+        }
+        len = prefix;
+    } else {
+        const char *mask;
+        ip = config_setting_get_string_elem(network, 0);
+        mask = config_setting_get_string_elem(network, 1);
+        if (ip == NULL || mask == NULL) {
+            cerr << "Wrong network, use (\"ip\", \"mask\")" << endl;
+            return false;
+        }
+
+        // Only contiguous masks can be matched by prefix
+        in_addr_t m = ntohl(inet_addr(mask));
+        len = 0;
+        while (len < 32 && (m & (0x80000000u >> len))) len++;
+        if (len < 32 && (m << len) != 0) {
+            cerr << "Wrong mask " << mask << ", it's not contiguous" << endl;
+            return false;
+        }
+    }
+
+    struct in6_addr net;
+    int family = strchr(ip, ':') ? AF_INET6 : AF_INET;
+    if (inet_pton(family, ip, &net) != 1) {
+        cerr << "Wrong network address " << ip << endl;
+        return false;
+    }
+    if (len < 0 || len > (family == AF_INET6 ? 128 : 32)) {
+        cerr << "Wrong prefix length " << len << " for " << ip << endl;
+        return false;
+    }
+
+    cout << "Adding " << ip << "/" << len << " as internal network" << endl;
+    conf->nets.add(family, &net, len, index);
+    if (layout) layout->addNetwork(family, &net, len, index);
+    addFilterNet(conf, family, &net, len);
+    return true;
+}
+
+// Read the internal networks of the config into conf (and layout, if
+// set), returns false on error
+bool loadNetworks(config_t *config, struct net_config *conf, SubnetLayout *layout)
+{
+    config_setting_t *networks = config_lookup(config, "internal_networks");
+    if (networks == NULL) {
+        cerr << "internal_networks parameter is required in config file!" << endl;
+        return false;
+    }
+
+    config_setting_t *network;
+    int i=0;
+    while ((network = config_setting_get_elem(networks, i)) != NULL) {
+        if (!addInternalNet(network, i, conf, layout)) return false;
+        i++;
+    }
+    conf->nets.build();
+    buildFilters(conf, KERNEL_FILTER);
+    return true;
+}
+
+// Add the rollup prefix lengths of the given family (list of ints)
+bool addRollupPrefixes(config_setting_t *prefixes, int family)
+{
+    int max = family == AF_INET6 ? 128 : 32;
+    for (int i = 0; i < config_setting_length(prefixes); i++) {
+        int len = config_setting_get_int_elem(prefixes, i);
+        if (len <= 0 || len > max) {
+            cerr << "Wrong rollup prefix length " << len << endl;
+            return false;
+        }
+        subnetLayout.addPrefix(family, len);
+    }
+    return true;
+}
+
+// Create the stats dumper of the given type, writing to file (if set,
+// collector address for IPFIX)
+bool createDumper(const char *type, const char *file)
+{
+    if (strcmp(type, "console") == 0) {
+        dumper = new ConsoleBWStatsDumper();
+    } else if (strcmp(type, "json") == 0) {
+        JSONBWStatsDumper *json = new JSONBWStatsDumper(file);
+        if (!json->open()) return false;
+        dumper = json;
+    } else if (strcmp(type, "binary") == 0) {
+        if (file == NULL) {
+            cerr << "dump_file parameter is required for binary dumps" << endl;
+            return false;
+        }
+        dumper = new BinaryBWStatsDumper(file);
+    } else if (strcmp(type, "ipfix") == 0) {
+        if (file == NULL) {
+            cerr << "dump_file parameter (collector host:port) is required for ipfix dumps" << endl;
+            return false;
+        }
+        IPFIXBWStatsDumper *ipfix = new IPFIXBWStatsDumper(file, IPFIX_TEMPLATE_REFRESH);
+        if (!ipfix->open()) return false;
+        dumper = ipfix;
+    } else {
+        cerr << "Unknown dumper " << type << endl;
+        return false;
+    }
+    return true;
+}
+
+// Print the current metrics on stderr
+void printMetrics()
+{
+    struct metrics_snapshot snapshot;
+    metrics.snapshot(&snapshot);
+
+    ConsoleBWStatsDumper console(cerr);
+    console.beginDump(time(NULL));
+    console.dumpMetrics(&snapshot);
+    console.endDump();
+}
+
+// Tick of the epochs: the shortest of the enabled update rates
+int computeTick(int dumpRate)
+{
+    int tick = dumpRate;
+    if (LIVE_STATS != NULL && LIVE_RATE > 0 && LIVE_RATE < tick) tick = LIVE_RATE;
+    if (OPENMETRICS_LISTEN != NULL && OPENMETRICS_RATE > 0 && OPENMETRICS_RATE < tick) {
+        tick = OPENMETRICS_RATE;
+    }
+    if (CHECKPOINT_FILE != NULL && CHECKPOINT_RATE < tick) tick = CHECKPOINT_RATE;
+    if (HOST_RATES && RATE_INTERVAL < tick) tick = RATE_INTERVAL;
+    return tick;
+}
+
+// Periods are counted in whole epochs: the dump and checkpoint rates must
+// be multiples of the tick
+bool checkTick(int dumpRate, int tick)
+{
+    const char *name = NULL;
+    int rate = 0;
+    if (dumpRate % tick != 0) {
+        name = "dump_rate";
+        rate = dumpRate;
+    } else if (CHECKPOINT_FILE != NULL && CHECKPOINT_RATE % tick != 0) {
+        name = "checkpoint_rate";
+        rate = CHECKPOINT_RATE;
+    }
+    if (name == NULL) return true;
+
+    cerr << name << " (" << rate << " s) must be a multiple of " << tick << " s, the shortest ";
+    cerr << "of live_rate, openmetrics_rate, checkpoint_rate and rate_interval in use" << endl;
+    return false;
+}
+
+// Wait until every capture thread is done with whatever it loaded before
+// (a capturePkts call started after the wait began)
+void waitGracePeriod()
+{
+    vector<unsigned long> passes(workers.size());
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        passes[i] = __atomic_load_n(&workers[i]->passes, __ATOMIC_SEQ_CST);
+    }
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        // Capture timeouts bound the wait (TO_MS) even without traffic
+        while (__atomic_load_n(&workers[i]->passes, __ATOMIC_SEQ_CST) == passes[i]) {
+            usleep(10000);
+        }
+    }
+}
+
+// Reload the internal networks and dump rate from the config file,
+// counters are kept. Anything else needs a restart
+void reload(const char *path)
+{
+    config_t config;
+    config_init(&config);
+    if (!config_read_file(&config, path)) {
+        cerr << "Reload failed: " << config_error_line(&config) << " - ";
+        cerr << config_error_text(&config) << endl;
+        config_destroy(&config);
+        return;
+    }
+
+    // New internal networks, rollups are laid out on the old ones
+    struct net_config *nets = NULL;
+    if (subnetLayout.size() > 0) {
+        cerr << "Internal networks not reloaded, subnet rollups need a restart" << endl;
+    } else {
+        nets = new net_config;
+        if (!loadNetworks(&config, nets, NULL)) {
+            cerr << "Reload failed, keeping the current internal networks" << endl;
+            delete nets;
+            nets = NULL;
+        }
+    }
+
+    // New dump rate, switched at the next epoch: the current period is
+    // dumped then and new ones start. Only this thread writes the clock
+    struct epoch_clock *old = epochClock;
+    struct epoch_clock *clock = NULL;
+    int dumpRate = old->tick * old->dumpTicks;
+    config_lookup_int(&config, "dump_rate", &dumpRate);
+    if (dumpRate <= 0) dumpRate = 600;
+    config_destroy(&config);
+
+    int tick = computeTick(dumpRate);
+    if (dumpRate == (int) (old->tick * old->dumpTicks)) {
+        // Unchanged
+    } else if (!checkTick(dumpRate, tick)) {
+        cerr << "Keeping the current dump rate: " << old->tick * old->dumpTicks << " s" << endl;
+    } else {
+        unsigned int epoch = epochAt(old, time(NULL)) + 1;
+
+        clock = new epoch_clock;
+        clock->start = old->start + (time_t) (epoch - old->base) * old->tick;
+        clock->base = epoch;
+        clock->tick = tick;
+        clock->dumpTicks = dumpRate / tick;
+        collector->reschedule(epoch, clock->dumpTicks, CHECKPOINT_RATE / tick, tick);
+    }
+
+    // Publish, and free the old ones once no capture thread uses them
+    struct net_config *oldNets = NULL;
+    struct epoch_clock *oldClock = NULL;
+    if (nets) oldNets = __atomic_exchange_n(&netConfig, nets, __ATOMIC_SEQ_CST);
+    if (clock) oldClock = __atomic_exchange_n(&epochClock, clock, __ATOMIC_SEQ_CST);
+    if (oldNets || oldClock) waitGracePeriod();
+    delete oldNets;
+    delete oldClock;
+
+    cout << "Reloaded " << path;
+    if (nets) cout << ", internal networks";
+    if (clock) cout << ", dump rate: " << dumpRate << " s";
+    cout << endl;
+}
+
+// Replay a pcap file as fast as possible and report the throughput
+int replay(const char *file)
+{
+    worker *w = newWorker(new ReplayCapture(file), CAPTURE_BOTH);
+    if (w == NULL) return 1;
+    if (!collector->start()) return 1;
+
+    struct timeval start, end;
+    unsigned long long packets = 0;
+    int res;
+
+    // Dump periods start with the first packet
+    startTime = epochClock->start = 0;
+    gettimeofday(&start, NULL);
+    while ((res = capturePkts(w)) >= 0) {
+        packets += res;
+    }
+    gettimeofday(&end, NULL);
+
+    if (res != CAPTURE_EOF) {
+        cerr << "Error reading " << file << endl;
+        return 1;
+    }
+
+    // Dump what is left
+    if (w->flows) w->flows->flush(w->stats);
+    unsigned int dumpTicks = epochClock->dumpTicks;
+    collector->swap(w->id, w->stats, w->epoch, (w->epoch / dumpTicks + 1) * dumpTicks);
+    collector->drain();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    // stdout has the dump, report goes to stderr
+    cerr << "Packets: " << packets << endl;
+    cerr << "Time: " << elapsed << " s" << endl;
+    if (packets > 0 && elapsed > 0) {
+        cerr << "Rate: " << packets / elapsed / 1e6 << " Mpps" << endl;
+        cerr << "Cost: " << elapsed * 1e9 / packets << " ns/packet" << endl;
+    }
+    cerr << "Peak RSS: " << usage.ru_maxrss << " KB" << endl;
+    return 0;
+}
+
 int main (int argc,char *argv[])
 {
     config_t config;
+    const char *replayFile = NULL;
+
+    // Replay mode (optional)
+    if (argc == 4 && strcmp(argv[1], "--replay") == 0) {
+        replayFile = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
 
     // Process conf file
     if (argc != 2) {
         cerr << "A parameter is required: configuration file" << endl;
+        cerr << "Usage: " << argv[0] << " [--replay file.pcap] config" << endl;
         return 1;
     }
 
@@ -123,60 +958,215 @@ int main (int argc,char *argv[])
         return 1;
     }
 
-    // Device to listen on
-    const char *dev = NULL;
-    config_lookup_string(&config, "dev", &dev);
+    // Devices to listen on, a list or a single one
+    vector<struct device> devices;
+    config_setting_t *devList = config_lookup(&config, "devices");
+    if (devList != NULL) {
+        for (int d = 0; d < config_setting_length(devList); d++) {
+            if (!addDevice(config_setting_get_elem(devList, d), &devices)) return 1;
+        }
+    } else {
+        config_setting_t *dev = config_lookup(&config, "dev");
+        if (dev != NULL && !addDevice(dev, &devices)) return 1;
+    }
+    // Capture method and threads (optional)
+    const char *method = "pcap";
+    int threads = 1;
+    config_lookup_string(&config, "capture", &method);
+    config_lookup_int(&config, "capture_threads", &threads);
+
+    // NFLOG groups to read from, instead of the devices
+    config_setting_t *groups = config_lookup(&config, "nflog_groups");
+    bool nflog = strcmp(method, "nflog") == 0;
+    if (replayFile == NULL && nflog && (groups == NULL || config_setting_length(groups) == 0)) {
+        cerr << "nflog_groups parameter is required for nflog capture" << endl;
+        return 1;
+    }
+    if (replayFile == NULL && !nflog && devices.empty()) {
+        cerr << "dev or devices parameter is required in config file!" << endl;
+        return 1;
+    }
 
     // Dump rate (optional)
     config_lookup_int(&config, "dump_rate", &DUMP_RATE);
+    if (DUMP_RATE <= 0) DUMP_RATE = 600;
 
-    // Configure internal networks
-    config_setting_t *networks = config_lookup(&config, "internal_networks");
-    if (networks == NULL) {
-        cerr << "internal_networks parameter is required in config file!" << endl;
+    // Live stats (optional)
+    config_lookup_string(&config, "live_stats", &LIVE_STATS);
+    config_lookup_int(&config, "live_rate", &LIVE_RATE);
+    config_lookup_int(&config, "live_hosts", &LIVE_HOSTS);
+
+    // OpenMetrics endpoint (optional)
+    config_lookup_string(&config, "openmetrics_listen", &OPENMETRICS_LISTEN);
+    config_lookup_int(&config, "openmetrics_rate", &OPENMETRICS_RATE);
+
+    // Checkpoint (optional), not used when replaying
+    if (replayFile == NULL) {
+        config_lookup_string(&config, "checkpoint_file", &CHECKPOINT_FILE);
+    }
+    config_lookup_int(&config, "checkpoint_rate", &CHECKPOINT_RATE);
+    config_lookup_int(&config, "checkpoint_hosts", &CHECKPOINT_HOSTS);
+    if (CHECKPOINT_RATE <= 0) CHECKPOINT_RATE = 60;
+
+    // Host rates (optional)
+    int hostRates = 0;
+    config_lookup_bool(&config, "host_rates", &hostRates);
+    config_lookup_int(&config, "rate_interval", &RATE_INTERVAL);
+    HOST_RATES = hostRates && RATE_INTERVAL > 0;
+    TICK = computeTick(DUMP_RATE);
+    if (!checkTick(DUMP_RATE, TICK)) return 1;
+
+    // Expected number of hosts (optional)
+    config_lookup_int(&config, "hosts_capacity", &HOSTS_CAPACITY);
+
+    // Stats output (optional)
+    const char *dumperType = "console";
+    const char *dumpFile = NULL;
+    config_lookup_string(&config, "dumper", &dumperType);
+    config_lookup_string(&config, "dump_file", &dumpFile);
+    config_lookup_int(&config, "ipfix_template_refresh", &IPFIX_TEMPLATE_REFRESH);
+    if (!createDumper(dumperType, dumpFile)) return 1;
+
+    // Top-K mode (optional)
+    config_lookup_int(&config, "top_hosts", &TOP_HOSTS);
+
+    // Hosts limit (optional), top-K mode is already bounded
+    config_lookup_int(&config, "max_hosts", &MAX_HOSTS);
+
+    // Flow accounting (optional)
+    config_lookup_int(&config, "flow_capacity", &FLOW_CAPACITY);
+    config_lookup_int(&config, "flow_idle_timeout", &FLOW_IDLE_TIMEOUT);
+    config_lookup_int(&config, "flow_active_timeout", &FLOW_ACTIVE_TIMEOUT);
+
+    // Packet sampling (optional)
+    const char *sampling = "random";
+    config_lookup_string(&config, "sampling", &sampling);
+    config_lookup_int(&config, "sampling_rate", &SAMPLING_RATE);
+    if (SAMPLING_RATE < 1 || SAMPLING_RATE > (int) SAMPLING_MAX_RATE) {
+        cerr << "sampling_rate must be between 1 and " << SAMPLING_MAX_RATE << endl;
         return 1;
     }
+    if (strcmp(sampling, "random") == 0) {
+        SAMPLING_MODE = SAMPLING_RANDOM;
+    } else if (strcmp(sampling, "flow") == 0) {
+        SAMPLING_MODE = SAMPLING_FLOW;
+    } else {
+        cerr << "Unknown sampling " << sampling << ", use random or flow" << endl;
+        return 1;
+    }
+    if (SAMPLING_RATE == 1) SAMPLING_MODE = SAMPLING_NONE;
+    SAMPLING_SALT = ((uint64_t) time(NULL) << 32) ^ getpid();
 
-    config_setting_t *network;
-    int i=0;
-    while ((network = config_setting_get_elem(networks, i++)) != NULL) {
-        const char *ip, *mask;
-        ip = config_setting_get_string_elem(network, 0);
-        mask = config_setting_get_string_elem(network, 1);
-        cout << "Adding " << ip << "/" << mask << " as internal network" << endl;
-        stats.addInternalNet(inet_addr(ip), inet_addr(mask));
+    // Only internal traffic reaches userspace, unless disabled
+    int kernelFilter = 1;
+    config_lookup_bool(&config, "kernel_filter", &kernelFilter);
+    KERNEL_FILTER = kernelFilter;
+
+    // Configure internal networks
+    netConfig = new net_config;
+    if (!loadNetworks(&config, netConfig, &subnetLayout)) return 1;
+
+    collector = new StatsCollector(dumper, HOSTS_CAPACITY);
+    if (TOP_HOSTS > 0) collector->setTopHosts(TOP_HOSTS);
+    else if (MAX_HOSTS > 0) collector->setMaxHosts(MAX_HOSTS);
+    collector->setDumpTicks(DUMP_RATE / TICK);
+    if (LIVE_STATS != NULL && LIVE_RATE > 0) {
+        SharedMemBWStatsDumper *live = new SharedMemBWStatsDumper(LIVE_STATS, LIVE_HOSTS);
+        if (!live->open()) return 1;
+        collector->setLive(live);
+    }
+    OpenMetricsBWStatsDumper *exporter = NULL;
+    if (OPENMETRICS_LISTEN != NULL) {
+        exporter = new OpenMetricsBWStatsDumper();
+        if (!exporter->open(OPENMETRICS_LISTEN)) return 1;
+        collector->setExporter(exporter);
+    }
+    if (HOST_RATES) collector->setRates(TICK);
+    if (CHECKPOINT_FILE != NULL && CHECKPOINT_HOSTS > 0) {
+        CheckpointBWStatsDumper *checkpoint =
+            new CheckpointBWStatsDumper(CHECKPOINT_FILE, CHECKPOINT_HOSTS);
+        if (!checkpoint->open()) return 1;
+        collector->setCheckpoint(checkpoint, CHECKPOINT_RATE / TICK);
     }
 
+    // Per VLAN stats (optional)
+    int vlanStats = 0;
+    config_lookup_bool(&config, "vlan_stats", &vlanStats);
+    if (vlanStats) collector->setVLANs();
 
-    // Enable capture on the device
-    // TODO take into account other layers than ethernet (WiFi, PPoE?)
-    cout << "Listening on " << dev << endl;
-    pcap_t* descr = pcap_open_live(dev, CAPTURE_SIZE, 0, TO_MS, ERROR_BUF);
+    // Distinct peers and ports per host (optional)
+    int hostCardinality = 0;
+    config_lookup_bool(&config, "host_cardinality", &hostCardinality);
+    if (hostCardinality) collector->setCardinality();
 
-    if (descr == NULL) {
-        cerr << "Error opening " << dev << ". Are you root?" << endl;
-        return 1;
+    // Subnet rollups (optional)
+    config_setting_t *prefixes4 = config_lookup(&config, "rollup_prefixes");
+    config_setting_t *prefixes6 = config_lookup(&config, "rollup_prefixes6");
+    if (prefixes4 != NULL && !addRollupPrefixes(prefixes4, AF_INET)) return 1;
+    if (prefixes6 != NULL && !addRollupPrefixes(prefixes6, AF_INET6)) return 1;
+    if ((prefixes4 != NULL || prefixes6 != NULL) && subnetLayout.build()) {
+        collector->setSubnets(&subnetLayout);
     }
 
-    // Configure the filter
+    // Self instrumentation, always collected and added to the dumps
+    // unless disabled
+    int dumpMetrics = 1;
+    config_lookup_bool(&config, "metrics", &dumpMetrics);
+    collector->setMetrics(&metrics, dumpMetrics);
+    startTime = time(NULL);
+    epochClock = new epoch_clock;
+    epochClock->start = startTime;
+    epochClock->base = 0;
+    epochClock->tick = TICK;
+    epochClock->dumpTicks = DUMP_RATE / TICK;
+
+    if (replayFile != NULL) return replay(replayFile);
+
+    // Counters of the period interrupted by the last shutdown or crash
+    unsigned int restored = collector->restore();
+    if (restored > 0) cout << "Restored " << restored << " hosts from " << CHECKPOINT_FILE << endl;
+
+    // SIGUSR1 prints the metrics and SIGHUP reloads the config. They are
+    // only handled by this thread, the capture and collector ones inherit
+    // the signals blocked
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // Enable capture on the devices
     // Capture everything and pass it to the handler
+    // TODO WiFi link types (802.11, radiotap)
     // TODO filter per vlan (vlan 1 or vlan2 or...)
-    struct bpf_program fp;
-    bpf_u_int32 netp;
-    bpf_u_int32 maskp;
-    pcap_lookupnet(dev, &netp, &maskp, ERROR_BUF);
-    if (pcap_compile(descr, &fp, "ip", 0, netp) < 0) {
-        perror("pcap_compile");
-        return 1;
-    }
-
-    if (pcap_setfilter(descr, &fp) < 0) {
-        perror("pcap_setfilter");
-        return 1;
+    if (nflog) {
+        // One thread per group
+        for (int g = 0; g < config_setting_length(groups); g++) {
+            int group = config_setting_get_int_elem(groups, g);
+            cout << "Listening on NFLOG group " << group << endl;
+            if (!startWorker(new NflogCapture(group, IP_CAPTURE_SIZE, TO_MS), CAPTURE_BOTH)) {
+                cerr << "Error opening NFLOG group " << group << ". Are you root?" << endl;
+                return 1;
+            }
+        }
+    } else {
+        if (strcmp(method, "ring") != 0 && strcmp(method, "pcap") != 0) {
+            cerr << "Unknown capture method " << method << ", using libpcap" << endl;
+            method = "pcap";
+        }
+        for (unsigned int d = 0; d < devices.size(); d++) {
+            if (!startDevice(&devices[d], method, threads, (getpid() + d) & 0xffff)) return 1;
+        }
     }
 
-    pcap_loop(descr, -1, processPkt, NULL);
+    if (!collector->start()) return 1;
+    if (exporter && !exporter->start()) return 1;
 
-    return 0;
+    // Capture and collector threads go on, this one waits for signals
+    for (;;) {
+        int sig;
+        if (sigwait(&signals, &sig) != 0) continue;
+        if (sig == SIGUSR1) printMetrics();
+        if (sig == SIGHUP) reload(argv[1]);
+    }
 }
-
@@ -23,111 +23,248 @@ using namespace std;
 
 /* BWStats */
 
-void BWStats::addInternalNet(in_addr_t ip, in_addr_t mask) {
-    struct network net;
-    net.ip = ip & mask;
-    net.mask = mask;
-    inets.push_back(net);
+BWStats::BWStats() {
+    inets = NULL;
+    top = NULL;
+    rates = NULL;
+    subnets = NULL;
+    rollups = NULL;
+    vlans = NULL;
+    cardinality = false;
+    sink = NULL;
 }
 
-void BWStats::addPacket(const struct ip* ip) {
-    in_addr_t src = ip->ip_src.s_addr;
-    in_addr_t dst = ip->ip_dst.s_addr;
-    bool srcInt = isInternal(src);
-    bool dstInt = isInternal(dst);
+BWStats::~BWStats() {
+    delete top;
+    delete rates;
+    delete[] rollups;
+    delete[] vlans;
+}
+
+void BWStats::setRates(unsigned int buckets, unsigned int width, unsigned int capacity) {
+    delete rates;
+    rates = new HostRates(buckets, width, capacity);
+}
+
+void BWStats::tick() {
+    if (rates) rates->tick();
+}
+
+void BWStats::setTopHosts(unsigned int k) {
+    delete top;
+    top = new TopHosts(k);
+}
+
+void BWStats::setInternalNets(const NetClassifier *nets) {
+    inets = nets;
+}
+
+void BWStats::setSubnets(const SubnetLayout *layout) {
+    delete[] rollups;
+    subnets = layout;
+    rollups = new HostStats[layout->size()];
+    for (unsigned int i = 0; i < layout->size(); i++) {
+        rollups[i] = HostStats(layout->getAddr(i));
+    }
+}
+
+void BWStats::setVLANs() {
+    delete[] vlans;
+    vlans = new HostStats[VLAN_COUNT];
+}
+
+void BWStats::evictHost(HostStats *host) {
+    // Its rates are dumped with it
+    if (sink) sink->evictHost(host);
+    if (rates) rates->remove(host->getIP());
+}
+
+void BWStats::addPacket(const struct packet_info* pkt) {
+    int srcNet = getNetwork(&pkt->src);
+    int dstNet = getNetwork(&pkt->dst);
+    uint64_t srcHash = srcNet >= 0 ? HostTable::hash(&pkt->src) : 0;
+    uint64_t dstHash = dstNet >= 0 ? HostTable::hash(&pkt->dst) : 0;
+
+    account(pkt, srcNet, dstNet, srcHash, dstHash);
+}
+
+void BWStats::account(const struct packet_info* pkt, int srcNet, int dstNet,
+                      uint64_t srcHash, uint64_t dstHash) {
+    const struct in6_addr *src = &pkt->src;
+    const struct in6_addr *dst = &pkt->dst;
+    bool srcInt = srcNet >= 0;
+    bool dstInt = dstNet >= 0;
+    unsigned long long len = (unsigned long long) pkt->len * pkt->weight;
 
     // account traffic depending on source and destination
     if (srcInt) {
-        if (dstInt) getHost(src)->addIntPacket(ip);
-        else        getHost(src)->addExtPacket(ip);
+        HostStats *host = getHost(src, srcHash, len);
+        if (dstInt) {
+            host->addIntPacket(pkt);
+        } else {
+            host->addExtPacket(pkt);
+            if (cardinality) host->addPeer(HostTable::hash(dst), pkt->proto, pkt->dport);
+        }
     }
     if (dstInt) {
-        if (srcInt) getHost(dst)->addIntPacket(ip);
-        else        getHost(dst)->addExtPacket(ip);
-    }
-}
-
-bool BWStats::isInternal(in_addr_t ip) {
-    for (netvector::iterator net = inets.begin(); net != inets.end(); ++net) {
-        if (net->ip == (ip & net->mask)) {
-            return true;
+        HostStats *host = getHost(dst, dstHash, len);
+        if (srcInt) {
+            host->addIntPacket(pkt);
+        } else {
+            host->addExtPacket(pkt);
+            if (cardinality) host->addPeer(HostTable::hash(src), pkt->proto, pkt->sport);
         }
     }
-    return false;
-}
 
-HostStats* BWStats::getHost(in_addr_t ip) {
-    hostsmap::iterator it = data.find(ip);
-    if (it == data.end()) {
-        // create host
-        data[ip] = new HostStats(ip);
+    if (subnets) {
+        if (srcInt) rollup(pkt, src, srcNet, dstInt);
+        if (dstInt) rollup(pkt, dst, dstNet, srcInt);
     }
-    return data[ip];
-}
 
-void BWStats::dump(IBWStatsDumper *dumper) {
-    hostsmap::iterator it;
-    for (it=data.begin(); it != data.end(); it++) {
-        dumper->dumpHost(it->second);
+    if (vlans) {
+        HostStats *vlan = &vlans[pkt->vlan];
+        if (srcInt) (dstInt ? vlan->getInternalBW() : vlan->getExternalBW())->addPacket(pkt, src);
+        if (dstInt) (srcInt ? vlan->getInternalBW() : vlan->getExternalBW())->addPacket(pkt, dst);
     }
 }
 
-void BWStats::clear() {
-    hostsmap::iterator it;
-    for (it=data.begin(); it != data.end(); it++) {
-        delete (it->second);
+void BWStats::rollup(const struct packet_info* pkt, const struct in6_addr *ip,
+                     int net, bool internal) {
+    unsigned int slots[SUBNET_MAX_LEVELS];
+    unsigned int n = subnets->lookup(net, ip, slots);
+
+    for (unsigned int i = 0; i < n; i++) {
+        HostStats *subnet = &rollups[slots[i]];
+        if (internal) subnet->getInternalBW()->addPacket(pkt, ip);
+        else          subnet->getExternalBW()->addPacket(pkt, ip);
     }
-    data.clear();
 }
 
+int BWStats::getNetwork(const struct in6_addr *ip) {
+    return inets->lookup(ip);
+}
 
-/* HostStats */
+HostStats* BWStats::getHost(const struct in6_addr *ip) {
+    return data.get(ip);
+}
 
-HostStats::HostStats(in_addr_t host) {
-    ip.s_addr = host;
+void BWStats::reserve(unsigned int hosts) {
+    data.reserve(hosts);
 }
 
-void HostStats::addIntPacket(const struct ip* ipp) {
-    addPacket(ipp, &internal);
+void BWStats::setMaxHosts(unsigned int hosts, IHostSink *sink) {
+    this->sink = sink;
+    data.setLimit(hosts, this);
 }
 
-void HostStats::addExtPacket(const struct ip* ipp) {
-    addPacket(ipp, &external);
+void BWStats::addFlow(const FlowStats *flow) {
+    flows.push_back(*flow);
 }
 
-void HostStats::addPacket(const struct ip* ipp, BWSummary *sum) {
-    in_addr_t src = ipp->ip_src.s_addr;
-    in_addr_t dst = ipp->ip_dst.s_addr;
-    long len = ntohs(ipp->ip_len);
+void BWStats::merge(BWStats *other) {
+    if (top) {
+        if (rates) {
+            for (unsigned int i = 0; i < other->top->size(); i++) {
+                HostStats *host = other->top->at(i);
+                rates->add(host->getIP(), hostBytes(host));
+            }
+        }
+        top->merge(other->top);
+    }
+    for (unsigned int i = 0; i < other->data.capacity(); i++) {
+        HostStats *host = other->data.at(i);
+        if (!host) continue;
+        getHost(host->getIP())->merge(host);
+        if (rates) rates->add(host->getIP(), hostBytes(host));
+    }
+    if (subnets) {
+        for (unsigned int i = 0; i < subnets->size(); i++) {
+            if (!other->rollups[i].isEmpty()) rollups[i].merge(&other->rollups[i]);
+        }
+    }
+    if (vlans) {
+        for (unsigned int i = 0; i < VLAN_COUNT; i++) {
+            if (!other->vlans[i].isEmpty()) vlans[i].merge(&other->vlans[i]);
+        }
+    }
+}
 
-    sum->numPackets++;
-    if (src == ip.s_addr) sum->totalSent += len;
-    if (dst == ip.s_addr) sum->totalRecv += len;
+void BWStats::restore(HostStats *host, unsigned long long error) {
+    if (top) top->restore(host->getIP(), hostBytes(host), error)->merge(host);
+    else     getHost(host->getIP())->merge(host);
+}
 
-    switch (ipp->ip_p) {
-        case 6: // TCP
-            sum->TCP += len;
-            break;
+void BWStats::dump(IBWStatsDumper *dumper, bool withRates,
+                   const struct metrics_snapshot *metrics) {
+    dumper->beginDump(time(NULL));
+    dumpEntries(dumper, withRates, metrics);
+    dumper->endDump();
+}
 
-        case 17: // UDP
-            sum->UDP += len;
-            break;
+void BWStats::dumpEntries(IBWStatsDumper *dumper, bool withRates,
+                          const struct metrics_snapshot *metrics) {
+    struct rate_summary summary;
+    withRates = withRates && rates;
 
-        case 1: // ICMP
-            sum->ICMP += len;
-            break;
+    for (unsigned int i = 0; i < data.capacity(); i++) {
+        HostStats *host = data.at(i);
+        if (!host) continue;
+        dumper->dumpHost(host);
+        if (withRates && rates->get(host->getIP(), &summary)) {
+            dumper->dumpRates(host, &summary);
+        }
+    }
+    if (top) {
+        for (unsigned int i = 0; i < top->size(); i++) {
+            HostStats *host = top->at(i);
+            dumper->dumpTopHost(host, top->getError(i));
+            if (withRates && rates->get(host->getIP(), &summary)) {
+                dumper->dumpRates(host, &summary);
+            }
+        }
+        dumper->dumpOther(top->getOther(), top->getEvicted(), top->threshold());
     }
+    if (subnets) {
+        for (unsigned int i = 0; i < subnets->size(); i++) {
+            if (rollups[i].isEmpty()) continue;
+            dumper->dumpSubnet(&rollups[i], subnets->getLength(i));
+        }
+    }
+    if (vlans) {
+        for (unsigned int i = 0; i < VLAN_COUNT; i++) {
+            if (!vlans[i].isEmpty()) dumper->dumpVLAN(&vlans[i], i);
+        }
+    }
+    if (metrics) dumper->dumpMetrics(metrics);
 }
 
+void BWStats::dumpFlows(IBWStatsDumper *dumper) {
+    for (unsigned int i = 0; i < flows.size(); i++) {
+        dumper->dumpFlow(&flows[i]);
+    }
+}
 
-/* BWSummary */
-BWSummary::BWSummary() {
-    totalRecv = 0;
-    totalSent = 0;
-    numPackets = 0;
+unsigned int BWStats::hostCount() {
+    return top ? top->size() : data.size();
+}
 
-    TCP = 0;
-    UDP = 0;
-    ICMP= 0;
+unsigned int BWStats::hostCapacity() {
+    return top ? top->capacity() : data.capacity();
 }
 
+void BWStats::clear() {
+    data.clear();
+    if (top) top->clear();
+    if (rates) rates->clear();
+    if (subnets) {
+        for (unsigned int i = 0; i < subnets->size(); i++) {
+            if (!rollups[i].isEmpty()) rollups[i] = HostStats(subnets->getAddr(i));
+        }
+    }
+    if (vlans) {
+        for (unsigned int i = 0; i < VLAN_COUNT; i++) {
+            if (!vlans[i].isEmpty()) vlans[i] = HostStats();
+        }
+    }
+    flows.clear();
+}
@@ -19,101 +19,189 @@
 #define BWSTATS
 
 #include <netinet/ip.h>
-#include <map>
+#include <time.h>
 #include <vector>
+#include "packet.h"
+#include "hoststats.h"
+#include "hosttable.h"
+#include "flowtable.h"
+#include "tophosts.h"
+#include "hostrates.h"
+#include "classifier.h"
+#include "subnets.h"
+#include "metrics.h"
 
 using namespace std;
 
-/* Bandwidth usage container */
-class BWSummary {
+// Stats dumper interface
+class IBWStatsDumper
+{
   public:
-    BWSummary();
-    void addPacket(const struct ip* ip);
-
-    unsigned long long totalRecv;
-    unsigned long long totalSent;
-    unsigned long long numPackets;
-    // per protocol:
-    unsigned long long TCP;
-    unsigned long long UDP;
-    unsigned long long ICMP;
-};
+    // A dump starts, all its entries share the given timestamp
+    virtual void beginDump(time_t timestamp) = 0;
 
+    virtual void dumpHost(HostStats *host) = 0;
 
-/* Bandwidth usage stats for a IP */
-class HostStats {
-  public:
-    // Constructor
-    HostStats(in_addr_t ip);
+    // Peak, average and 95th percentile rates of the host just dumped
+    virtual void dumpRates(HostStats *host, const struct rate_summary *rates) = 0;
 
-    // Add internal traffic package to this host
-    void addIntPacket(const struct ip* ipp);
+    // Flow that expired or was evicted from a flow table
+    virtual void dumpFlow(FlowStats *flow) = 0;
 
-    // Add external traffic package to this host
-    void addExtPacket(const struct ip* ipp);
+    // Top-K mode: tracked host, it may have moved up to error bytes more
+    virtual void dumpTopHost(HostStats *host, unsigned long long error) = 0;
 
-    in_addr getIP() { return ip; }
-    BWSummary* getInternalBW() { return &internal; }
-    BWSummary* getExternalBW() { return &external; }
+    // Top-K mode: traffic of the evicted hosts, hosts not dumped moved at
+    // most threshold bytes
+    virtual void dumpOther(HostStats *other, unsigned long long evicted,
+                           unsigned long long threshold) = 0;
 
-  private:
-    in_addr ip;
+    // Traffic of the internal hosts in the subnet (address and len bits)
+    virtual void dumpSubnet(HostStats *subnet, int len) = 0;
 
-    // summarize packet data into internal or external holder
-    void addPacket(const struct ip* ipp, BWSummary* sum);
+    // Traffic of the internal hosts in the VLAN (0 is untagged traffic)
+    virtual void dumpVLAN(HostStats *vlan, unsigned int id) = 0;
 
-    // Internal and external traffic
-    BWSummary internal;
-    BWSummary external;
-};
+    // Self instrumentation metrics
+    virtual void dumpMetrics(const struct metrics_snapshot *metrics) = 0;
 
-// network struct
-struct network {
-    in_addr_t ip;
-    in_addr_t mask;
+    // The dump is finished, output can be flushed
+    virtual void endDump() = 0;
 };
 
-// hosts map
-typedef map<in_addr_t, HostStats*> hostsmap;
-
-// Vector of networks
-typedef vector<network> netvector;
 
-// Stats dumper interface
-class IBWStatsDumper
-{
+/* Bandwidth stats store for all the clients
+ *
+ * Flows leaving the capture threads flow tables are also kept here
+ * until the stats are dumped.
+ */
+class BWStats : public IFlowSink, public IHostSink {
   public:
-    virtual void dumpHost(HostStats *host) = 0;
-};
+    BWStats();
+    ~BWStats();
 
+    // Only keep the top k hosts by traffic (fixed memory, approximate)
+    void setTopHosts(unsigned int k);
 
-/* Bandwidth stats store for all the clients */
-class BWStats {
-  public:
-    // Add the network to the internal networks list
-    void addInternalNet(in_addr_t ip, in_addr_t mask);
+    // Preallocate room for the given number of hosts
+    void reserve(unsigned int hosts);
+
+    // Keep at most the given number of hosts (not in top-K mode), idle
+    // ones are evicted with their counters to sink to make room
+    void setMaxHosts(unsigned int hosts, IHostSink *sink);
+
+    // Keep per host time series of buckets ticks of width seconds, fed
+    // by merge() and moved forward by tick() (collector stats only)
+    void setRates(unsigned int buckets, unsigned int width, unsigned int capacity);
+
+    // Set the internal networks table (shared, it's not copied)
+    void setInternalNets(const NetClassifier *nets);
+
+    // Also sum the hosts traffic per subnet (layout shared, not copied)
+    void setSubnets(const SubnetLayout *layout);
+
+    // Also sum the hosts traffic per VLAN
+    void setVLANs();
+
+    // Also count the distinct external peers and ports of each host
+    void setCardinality() { cardinality = true; }
 
     // Process the packet and summarize it
-    void addPacket(const struct ip* ip);
+    void addPacket(const struct packet_info* pkt);
 
-    // Dump current stats using the given dumper
-    void dump(IBWStatsDumper *dumper);
+    // Keep a finished flow until the shard is handed over
+    void addFlow(const FlowStats *flow);
 
-    // Remove all known hosts (reset counters)
+    // Add all the hosts counters from other stats (shards merging), its
+    // flows are not kept (see dumpFlows)
+    void merge(BWStats *other);
+
+    // Add the counters of a host, with its top-K error (checkpoint
+    // recovery, host rates are not fed)
+    void restore(HostStats *host, unsigned long long error);
+
+    // Next time series bucket
+    void tick();
+
+    // Dump current stats using the given dumper (host rates too, if kept
+    // and withRates is set, and the given metrics)
+    void dump(IBWStatsDumper *dumper, bool withRates = true,
+              const struct metrics_snapshot *metrics = NULL);
+
+    // Same, within a dump begun and ended by the caller
+    void dumpEntries(IBWStatsDumper *dumper, bool withRates = true,
+                     const struct metrics_snapshot *metrics = NULL);
+
+    // Dump the finished flows kept, within a dump begun by the caller
+    void dumpFlows(IBWStatsDumper *dumper);
+
+    // Rates of a host so far, returns false if unknown or not kept
+    bool getRates(const struct in6_addr *ip, struct rate_summary *summary) {
+        return rates && rates->get(ip, summary);
+    }
+
+    // A host left the host table, forget its rates after telling the max
+    // hosts sink
+    void evictHost(HostStats *host);
+
+    // Number of hosts kept and room for them
+    unsigned int hostCount();
+    unsigned int hostCapacity();
+
+    // Number of finished flows kept
+    unsigned int flowCount() { return flows.size(); }
+
+    // Remove all known hosts and flows (reset counters)
     void clear();
 
   private:
     // returns a pointer to a host (creates it if doesn't exists)
-    HostStats* getHost(in_addr_t ip);
+    HostStats* getHost(const struct in6_addr *ip);
+
+    // Same, for a host about to be accounted len bytes
+    HostStats* getHost(const struct in6_addr *ip, uint64_t hash, unsigned long long len) {
+        return top ? top->get(ip, hash, len) : data.get(ip, hash);
+    }
+
+    // returns the internal network the given ip belongs to or -1
+    int getNetwork(const struct in6_addr *ip);
+
+    // account a classified packet to its internal hosts (and subnets)
+    void account(const struct packet_info* pkt, int srcNet, int dstNet,
+                 uint64_t srcHash, uint64_t dstHash);
+
+    // account a packet to the subnets of an internal host of net
+    void rollup(const struct packet_info* pkt, const struct in6_addr *ip,
+                int net, bool internal);
+
+    // <IP -> stats> table
+    HostTable data;
+
+    // Top-K hosts (replaces data if set)
+    TopHosts *top;
+
+    // Per host time series (optional)
+    HostRates *rates;
+
+    // Subnet counters, a slot per layout one (optional)
+    const SubnetLayout *subnets;
+    HostStats *rollups;
+
+    // VLAN counters, indexed by VLAN id (optional)
+    HostStats *vlans;
+
+    // Count distinct peers and ports
+    bool cardinality;
 
-    // returns true if the given ip belongs to an internal network
-    bool isInternal(in_addr_t ip);
+    // Evicted hosts go there too (max hosts)
+    IHostSink *sink;
 
-    // <IP -> stats> map
-    hostsmap data;
+    // Finished flows, until the shard is merged (bounded by the capture
+    // threads, see flushBatch)
+    vector<FlowStats> flows;
 
     // Internal networks (to distingish internal and external traffic)
-    vector<struct network> inets;
+    const NetClassifier *inets;
 };
 
 
@@ -0,0 +1,70 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(CAPTURE)
+#define CAPTURE
+
+#include <pcap.h>
+#include <stdint.h>
+
+// dispatch() result when there are no more packets (replays)
+const int CAPTURE_EOF = -2;
+
+// Packets captured: received by the device, sent by it or both
+enum capture_direction {
+    CAPTURE_BOTH,
+    CAPTURE_IN,
+    CAPTURE_OUT
+};
+
+// Capture statistics since it was opened
+struct capture_stats {
+    uint64_t received;      // packets that passed the filter, dropped included
+    uint64_t dropped;       // dropped for lack of buffer room
+    uint64_t ifDropped;     // dropped by the interface (0 if unknown)
+};
+
+/* Packet capture source interface */
+class ICapture
+{
+  public:
+    virtual ~ICapture() {};
+
+    // Start capturing, returns false on error
+    virtual bool open() = 0;
+
+    // Install the given (pcap syntax) filter in the kernel
+    virtual bool setFilter(const char *filter) = 0;
+
+    // Only capture the packets going in the given direction, once open.
+    // returns false if not supported
+    virtual bool setDirection(capture_direction dir) = 0;
+
+    // Link layer type (DLT_*) of the captured packets, once open
+    virtual int datalink() = 0;
+
+    // Get the capture statistics, returns false if not available. Only
+    // from the thread calling dispatch()
+    virtual bool getStats(struct capture_stats *stats) = 0;
+
+    // Wait for packets and pass them to the handler (pcap_dispatch
+    // semantics), returns the number of processed packets, -1 on error
+    // or CAPTURE_EOF if the capture ended
+    virtual int dispatch(pcap_handler handler, u_char *user) = 0;
+};
+
+#endif
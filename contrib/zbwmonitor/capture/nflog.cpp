@@ -0,0 +1,256 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "nflog.h"
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_log.h>
+
+using namespace std;
+
+// Receive buffer, room for a whole batch of messages
+const unsigned int NFLOG_BUFFER_SIZE = 1 << 18;
+
+// Kernel side batching: max packets and bytes per batch (the capture
+// timeout is the max wait)
+const uint32_t NFLOG_QTHRESH = 64;
+const uint32_t NFLOG_NLBUFSIZ = 1 << 16;
+
+// Socket buffer, bursts queue here while a batch is processed
+const int NFLOG_RCVBUF = 1 << 23;
+
+NflogCapture::NflogCapture(unsigned int group, int snaplen, int timeout) {
+    this->group = group;
+    this->snaplen = snaplen;
+    this->timeout = timeout;
+    fd = -1;
+    buffer = new u_char[NFLOG_BUFFER_SIZE];
+    seq = 0;
+    seqValid = false;
+    memset(&total, 0, sizeof(total));
+}
+
+NflogCapture::~NflogCapture() {
+    if (fd >= 0) close(fd);
+    delete[] buffer;
+}
+
+bool NflogCapture::open() {
+    fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER);
+    if (fd < 0) {
+        cerr << "socket(AF_NETLINK): " << strerror(errno) << endl;
+        return false;
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        cerr << "bind(netlink): " << strerror(errno) << endl;
+        return false;
+    }
+
+    // Larger buffer if allowed (FORCE needs CAP_NET_ADMIN)
+    int rcvbuf = NFLOG_RCVBUF;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    // dispatch() returns after timeout ms without packets
+    struct timeval tv;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // Kernels before 3.17 need the families bound to NFLOG, later ones
+    // ignore the commands
+    struct nfulnl_msg_config_cmd cmd;
+    int families[] = { AF_INET, AF_INET6 };
+    for (int i = 0; i < 2; i++) {
+        cmd.command = NFULNL_CFG_CMD_PF_UNBIND;
+        configure(families[i], 0, NFULA_CFG_CMD, &cmd, sizeof(cmd));
+        cmd.command = NFULNL_CFG_CMD_PF_BIND;
+        configure(families[i], 0, NFULA_CFG_CMD, &cmd, sizeof(cmd));
+    }
+
+    cmd.command = NFULNL_CFG_CMD_BIND;
+    if (!configure(AF_UNSPEC, group, NFULA_CFG_CMD, &cmd, sizeof(cmd))) {
+        cerr << "Cannot bind to NFLOG group " << group << endl;
+        return false;
+    }
+
+    // Copy the headers only (rules may ask for less), batch the packets
+    // and number them
+    struct nfulnl_msg_config_mode mode;
+    memset(&mode, 0, sizeof(mode));
+    mode.copy_mode = NFULNL_COPY_PACKET;
+    mode.copy_range = htonl(snaplen);
+    uint32_t nlbufsiz = htonl(NFLOG_NLBUFSIZ);
+    uint32_t qthresh = htonl(NFLOG_QTHRESH);
+    uint32_t wait = htonl(timeout / 10 > 0 ? timeout / 10 : 1);
+    uint16_t flags = htons(NFULNL_CFG_F_SEQ);
+    return configure(AF_UNSPEC, group, NFULA_CFG_MODE, &mode, sizeof(mode)) &&
+           configure(AF_UNSPEC, group, NFULA_CFG_NLBUFSIZ, &nlbufsiz, sizeof(nlbufsiz)) &&
+           configure(AF_UNSPEC, group, NFULA_CFG_QTHRESH, &qthresh, sizeof(qthresh)) &&
+           configure(AF_UNSPEC, group, NFULA_CFG_TIMEOUT, &wait, sizeof(wait)) &&
+           configure(AF_UNSPEC, group, NFULA_CFG_FLAGS, &flags, sizeof(flags));
+}
+
+bool NflogCapture::configure(uint8_t family, uint16_t group, uint16_t type,
+                             const void *data, unsigned int len) {
+    struct {
+        struct nlmsghdr nlh;
+        struct nfgenmsg nfg;
+        struct nlattr attr;
+        u_char data[32];
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.nfg) + NLA_HDRLEN + NLA_ALIGN(len));
+    req.nlh.nlmsg_type = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_CONFIG;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.nlh.nlmsg_seq = type;
+    req.nfg.nfgen_family = family;
+    req.nfg.version = NFNETLINK_V0;
+    req.nfg.res_id = htons(group);
+    req.attr.nla_len = NLA_HDRLEN + len;
+    req.attr.nla_type = type;
+    memcpy(req.data, data, len);
+
+    if (send(fd, &req, req.nlh.nlmsg_len, 0) < 0) {
+        cerr << "send(netlink): " << strerror(errno) << endl;
+        return false;
+    }
+
+    // Wait for the ack, packets logged meanwhile are dropped
+    for (;;) {
+        int res = recv(fd, buffer, NFLOG_BUFFER_SIZE, 0);
+        if (res < 0) {
+            if (errno == EINTR || errno == ENOBUFS) continue;
+            cerr << "recv(netlink): " << strerror(errno) << endl;
+            return false;
+        }
+
+        unsigned int left = res;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr*) buffer; NLMSG_OK(nlh, left);
+             nlh = NLMSG_NEXT(nlh, left)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR || nlh->nlmsg_seq != type) continue;
+            struct nlmsgerr *err = (struct nlmsgerr*) NLMSG_DATA(nlh);
+            if (err->error != 0) errno = -err->error;
+            return err->error == 0;
+        }
+    }
+}
+
+bool NflogCapture::setFilter(const char *filter) {
+    // The packets are chosen by the firewall rules
+    return true;
+}
+
+bool NflogCapture::setDirection(capture_direction dir) {
+    // Same, the rules say which packets are logged
+    return dir == CAPTURE_BOTH;
+}
+
+int NflogCapture::datalink() {
+    return DLT_RAW;
+}
+
+bool NflogCapture::getStats(struct capture_stats *stats) {
+    *stats = total;
+    return true;
+}
+
+int NflogCapture::dispatch(pcap_handler handler, u_char *user) {
+    int res = recv(fd, buffer, NFLOG_BUFFER_SIZE, 0);
+    if (res < 0) {
+        // Overruns are counted by the sequence gaps
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ENOBUFS) return 0;
+        cerr << "recv(netlink): " << strerror(errno) << endl;
+        return -1;
+    }
+
+    // Packets without a kernel timestamp take the batch arrival time
+    struct timeval now;
+    now.tv_sec = 0;
+
+    int count = 0;
+    unsigned int left = res;
+    for (struct nlmsghdr *nlh = (struct nlmsghdr*) buffer; NLMSG_OK(nlh, left);
+         nlh = NLMSG_NEXT(nlh, left)) {
+        if (nlh->nlmsg_type != ((NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET)) continue;
+
+        struct pcap_pkthdr pkthdr;
+        const u_char *payload = NULL;
+        bool stamped = false;
+
+        // Attributes after the nfnetlink header
+        int attrsLen = nlh->nlmsg_len - NLMSG_SPACE(sizeof(struct nfgenmsg));
+        struct nlattr *attr = (struct nlattr*) ((u_char*) NLMSG_DATA(nlh) + NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+        while (attrsLen >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= attrsLen) {
+            const u_char *data = (const u_char*) attr + NLA_HDRLEN;
+            unsigned int len = attr->nla_len - NLA_HDRLEN;
+
+            switch (attr->nla_type & NLA_TYPE_MASK) {
+                case NFULA_PAYLOAD:
+                    payload = data;
+                    pkthdr.caplen = pkthdr.len = len;
+                    break;
+                case NFULA_TIMESTAMP: {
+                    const struct nfulnl_msg_packet_timestamp *ts =
+                        (const struct nfulnl_msg_packet_timestamp*) data;
+                    pkthdr.ts.tv_sec = be64toh(ts->sec);
+                    pkthdr.ts.tv_usec = be64toh(ts->usec);
+                    stamped = true;
+                    break;
+                }
+                case NFULA_SEQ: {
+                    uint32_t n = ntohl(*(const uint32_t*) data);
+                    if (seqValid && n != seq) {
+                        total.received += (uint32_t) (n - seq);
+                        total.dropped += (uint32_t) (n - seq);
+                    }
+                    seq = n + 1;
+                    seqValid = true;
+                    break;
+                }
+            }
+
+            attrsLen -= NLA_ALIGN(attr->nla_len);
+            attr = (struct nlattr*) ((u_char*) attr + NLA_ALIGN(attr->nla_len));
+        }
+
+        total.received++;
+        if (payload == NULL) continue;
+        if (!stamped) {
+            if (now.tv_sec == 0) gettimeofday(&now, NULL);
+            pkthdr.ts = now;
+        }
+
+        handler(user, &pkthdr, payload);
+        count++;
+    }
+    return count;
+}
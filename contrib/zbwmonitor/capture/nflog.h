@@ -0,0 +1,67 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(NFLOGCAPTURE)
+#define NFLOGCAPTURE
+
+#include <pcap.h>
+#include <stdint.h>
+#include "capture.h"
+
+/* NFLOG capture, packets logged by the firewall to a netlink group
+ *
+ * Only the packets matching the NFLOG rules of the group are received,
+ * at the point of the ruleset where the rules are (after NAT in the
+ * POSTROUTING chain, for instance). The kernel queues up to a threshold
+ * of them (or timeout) in a single netlink message batch, which is read
+ * with one recv() call.
+ *
+ * Packets start at the IP header (DLT_RAW). Message sequence numbers
+ * are checked to count the packets lost when the socket overruns.
+ */
+class NflogCapture : public ICapture {
+  public:
+    NflogCapture(unsigned int group, int snaplen, int timeout);
+    ~NflogCapture();
+
+    bool open();
+    bool setFilter(const char *filter);
+    bool setDirection(capture_direction dir);
+    int datalink();
+    bool getStats(struct capture_stats *stats);
+    int dispatch(pcap_handler handler, u_char *user);
+
+  private:
+    unsigned int group;
+    int snaplen;
+    int timeout;
+
+    int fd;
+    u_char *buffer;
+
+    // Next sequence number expected, packets received and lost
+    uint32_t seq;
+    bool seqValid;
+    struct capture_stats total;
+
+    // Send a config message of the group with one attribute, wait for the
+    // kernel answer. returns false on error
+    bool configure(uint8_t family, uint16_t group, uint16_t type,
+                   const void *data, unsigned int len);
+};
+
+#endif
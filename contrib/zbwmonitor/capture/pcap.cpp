@@ -0,0 +1,99 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "pcap.h"
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+PcapCapture::PcapCapture(const char *dev, int snaplen, int timeout) {
+    this->dev = dev;
+    this->snaplen = snaplen;
+    this->timeout = timeout;
+    descr = NULL;
+    memset(&last, 0, sizeof(last));
+    memset(&total, 0, sizeof(total));
+}
+
+PcapCapture::~PcapCapture() {
+    if (descr != NULL) pcap_close(descr);
+}
+
+bool PcapCapture::open() {
+    char errbuf[PCAP_ERRBUF_SIZE];
+
+    descr = pcap_open_live(dev, snaplen, 0, timeout, errbuf);
+    if (descr == NULL) {
+        cerr << "Error opening " << dev << ": " << errbuf << endl;
+        return false;
+    }
+    return true;
+}
+
+bool PcapCapture::setFilter(const char *filter) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    struct bpf_program fp;
+    bpf_u_int32 netp;
+    bpf_u_int32 maskp;
+
+    pcap_lookupnet(dev, &netp, &maskp, errbuf);
+    if (pcap_compile(descr, &fp, filter, 0, netp) < 0) {
+        cerr << "pcap_compile: " << pcap_geterr(descr) << endl;
+        return false;
+    }
+
+    if (pcap_setfilter(descr, &fp) < 0) {
+        cerr << "pcap_setfilter: " << pcap_geterr(descr) << endl;
+        pcap_freecode(&fp);
+        return false;
+    }
+    pcap_freecode(&fp);
+    return true;
+}
+
+bool PcapCapture::setDirection(capture_direction dir) {
+    pcap_direction_t d = dir == CAPTURE_IN ? PCAP_D_IN :
+                         dir == CAPTURE_OUT ? PCAP_D_OUT : PCAP_D_INOUT;
+    if (pcap_setdirection(descr, d) < 0) {
+        cerr << "pcap_setdirection: " << pcap_geterr(descr) << endl;
+        return false;
+    }
+    return true;
+}
+
+int PcapCapture::datalink() {
+    return pcap_datalink(descr);
+}
+
+bool PcapCapture::getStats(struct capture_stats *stats) {
+    struct pcap_stat cur;
+    if (pcap_stats(descr, &cur) < 0) return false;
+
+    // Unsigned differences survive the counters wrapping around
+    total.received += (u_int) (cur.ps_recv - last.ps_recv);
+    total.dropped += (u_int) (cur.ps_drop - last.ps_drop);
+    total.ifDropped += (u_int) (cur.ps_ifdrop - last.ps_ifdrop);
+    last = cur;
+
+    *stats = total;
+    return true;
+}
+
+int PcapCapture::dispatch(pcap_handler handler, u_char *user) {
+    return pcap_dispatch(descr, -1, handler, user);
+}
@@ -0,0 +1,79 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "replay.h"
+#include <iostream>
+
+using namespace std;
+
+// Packets read per dispatch call
+const int REPLAY_BATCH = 1024;
+
+ReplayCapture::ReplayCapture(const char *file) {
+    this->file = file;
+    descr = NULL;
+}
+
+ReplayCapture::~ReplayCapture() {
+    if (descr != NULL) pcap_close(descr);
+}
+
+bool ReplayCapture::open() {
+    char errbuf[PCAP_ERRBUF_SIZE];
+
+    descr = pcap_open_offline(file, errbuf);
+    if (descr == NULL) {
+        cerr << "Error opening " << file << ": " << errbuf << endl;
+        return false;
+    }
+    return true;
+}
+
+bool ReplayCapture::setFilter(const char *filter) {
+    struct bpf_program fp;
+
+    if (pcap_compile(descr, &fp, filter, 0, PCAP_NETMASK_UNKNOWN) < 0) {
+        cerr << "pcap_compile: " << pcap_geterr(descr) << endl;
+        return false;
+    }
+
+    if (pcap_setfilter(descr, &fp) < 0) {
+        cerr << "pcap_setfilter: " << pcap_geterr(descr) << endl;
+        pcap_freecode(&fp);
+        return false;
+    }
+    pcap_freecode(&fp);
+    return true;
+}
+
+bool ReplayCapture::setDirection(capture_direction dir) {
+    // Files don't record it
+    return dir == CAPTURE_BOTH;
+}
+
+int ReplayCapture::datalink() {
+    return pcap_datalink(descr);
+}
+
+bool ReplayCapture::getStats(struct capture_stats *stats) {
+    return false;
+}
+
+int ReplayCapture::dispatch(pcap_handler handler, u_char *user) {
+    int res = pcap_dispatch(descr, REPLAY_BATCH, handler, user);
+    return res == 0 ? CAPTURE_EOF : res;
+}
@@ -0,0 +1,37 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <pcap.h>
+#include "capture.h"
+
+/* pcap file replay, packets are read as fast as possible */
+class ReplayCapture : public ICapture {
+  public:
+    ReplayCapture(const char *file);
+    ~ReplayCapture();
+
+    bool open();
+    bool setFilter(const char *filter);
+    bool setDirection(capture_direction dir);
+    int datalink();
+    bool getStats(struct capture_stats *stats);
+    int dispatch(pcap_handler handler, u_char *user);
+
+  private:
+    const char *file;
+    pcap_t *descr;
+};
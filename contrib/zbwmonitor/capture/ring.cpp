@@ -0,0 +1,275 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ring.h"
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+using namespace std;
+
+// Ring geometry: RING_BLOCKS blocks of RING_BLOCK_SIZE bytes per instance
+const unsigned int RING_BLOCK_SIZE = 1 << 20;
+const unsigned int RING_BLOCKS = 64;
+const unsigned int RING_FRAME_SIZE = 2048;
+
+RingCapture::RingCapture(const char *dev, int snaplen, int timeout, int fanout) {
+    this->dev = dev;
+    this->snaplen = snaplen;
+    this->timeout = timeout;
+    this->fanout = fanout;
+    direction = CAPTURE_BOTH;
+    fd = -1;
+    ring = NULL;
+    current = 0;
+    tagged = new u_char[snaplen + 4];
+    memset(&total, 0, sizeof(total));
+    ifDroppedStart = 0;
+}
+
+RingCapture::~RingCapture() {
+    if (ring != NULL) munmap(ring, RING_BLOCK_SIZE * RING_BLOCKS);
+    if (fd >= 0) close(fd);
+    delete[] tagged;
+}
+
+bool RingCapture::open() {
+    fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        cerr << "socket(AF_PACKET): " << strerror(errno) << endl;
+        return false;
+    }
+
+    // TPACKET_V3 has no snaplen, the kernel copies to the ring what the
+    // socket filter accepts: only snaplen bytes of every frame until
+    // setFilter installs the real one (compiled with the same snaplen)
+    struct sock_filter accept = BPF_STMT(BPF_RET | BPF_K, (unsigned int) snaplen);
+    struct sock_fprog truncate;
+    truncate.len = 1;
+    truncate.filter = &accept;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &truncate, sizeof(truncate)) < 0) {
+        cerr << "SO_ATTACH_FILTER: " << strerror(errno) << endl;
+        return false;
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        cerr << "PACKET_VERSION: " << strerror(errno) << endl;
+        return false;
+    }
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = RING_BLOCK_SIZE;
+    req.tp_block_nr = RING_BLOCKS;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = (RING_BLOCK_SIZE * RING_BLOCKS) / RING_FRAME_SIZE;
+    // Retire partially filled blocks after timeout so idle links get flushed
+    req.tp_retire_blk_tov = timeout;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        cerr << "PACKET_RX_RING: " << strerror(errno) << endl;
+        return false;
+    }
+
+    void *map = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCKS, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        cerr << "mmap: " << strerror(errno) << endl;
+        return false;
+    }
+    ring = (u_char*) map;
+
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = if_nametoindex(dev);
+    if (sll.sll_ifindex == 0) {
+        cerr << "Unknown device " << dev << endl;
+        return false;
+    }
+
+    // Frames are handed over as DLT_EN10MB
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0 || ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+        cerr << dev << " is not an Ethernet device" << endl;
+        return false;
+    }
+    if (bind(fd, (struct sockaddr*) &sll, sizeof(sll)) < 0) {
+        cerr << "bind(" << dev << "): " << strerror(errno) << endl;
+        return false;
+    }
+
+    ifDroppedStart = readIfDropped();
+
+    // Join the fanout group, flows are kept on the same socket
+    int arg = (fanout & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+    if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+        cerr << "PACKET_FANOUT: " << strerror(errno) << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool RingCapture::setFilter(const char *filter) {
+    // Compile it with libpcap, the kernel takes the same classic BPF code
+    pcap_t *dead = pcap_open_dead(DLT_EN10MB, snaplen);
+    struct bpf_program fp;
+    if (pcap_compile(dead, &fp, filter, 0, PCAP_NETMASK_UNKNOWN) < 0) {
+        cerr << "pcap_compile: " << pcap_geterr(dead) << endl;
+        pcap_close(dead);
+        return false;
+    }
+
+    struct sock_fprog prog;
+    prog.len = fp.bf_len;
+    prog.filter = (struct sock_filter*) fp.bf_insns;
+    int res = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+    if (res < 0) cerr << "SO_ATTACH_FILTER: " << strerror(errno) << endl;
+
+    pcap_freecode(&fp);
+    pcap_close(dead);
+    return res == 0;
+}
+
+bool RingCapture::setDirection(capture_direction dir) {
+    direction = dir;
+
+#if defined(PACKET_IGNORE_OUTGOING)
+    // Outgoing packets don't even reach the ring (Linux 4.20), on older
+    // kernels dispatch() skips them
+    int ignore = dir == CAPTURE_IN;
+    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+#endif
+    return true;
+}
+
+int RingCapture::datalink() {
+    return DLT_EN10MB;
+}
+
+bool RingCapture::getStats(struct capture_stats *stats) {
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+    if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) return false;
+
+    // tp_packets includes the dropped ones
+    total.received += st.tp_packets;
+    total.dropped += st.tp_drops;
+    total.ifDropped = readIfDropped() - ifDroppedStart;
+
+    *stats = total;
+    return true;
+}
+
+uint64_t RingCapture::readIfDropped() {
+    string path = string("/sys/class/net/") + dev + "/statistics/rx_dropped";
+    unsigned long long dropped = 0;
+
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%llu", &dropped) != 1) dropped = 0;
+    fclose(f);
+    return dropped;
+}
+
+int RingCapture::dispatch(pcap_handler handler, u_char *user) {
+    struct tpacket_block_desc *block;
+    block = (struct tpacket_block_desc*) (ring + current * RING_BLOCK_SIZE);
+
+    if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+            cerr << "poll: " << strerror(errno) << endl;
+            return -1;
+        }
+        if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) return 0;
+    }
+    __sync_synchronize();
+
+    // Walk all the packets in the block
+    unsigned int num = block->hdr.bh1.num_pkts;
+    struct tpacket3_hdr *hdr;
+    hdr = (struct tpacket3_hdr*) ((u_char*) block + block->hdr.bh1.offset_to_first_pkt);
+    struct tpacket3_hdr *next;
+    for (unsigned int i = 0; i < num; i++, hdr = next) {
+        next = (struct tpacket3_hdr*) ((u_char*) hdr + hdr->tp_next_offset);
+
+        // Skip the other direction packets, if only one is captured
+        if (direction != CAPTURE_BOTH) {
+            const struct sockaddr_ll *sll = (const struct sockaddr_ll*)
+                ((u_char*) hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            bool out = sll->sll_pkttype == PACKET_OUTGOING;
+            if (out != (direction == CAPTURE_OUT)) continue;
+        }
+
+        struct pcap_pkthdr pkthdr;
+        pkthdr.ts.tv_sec = hdr->tp_sec;
+        pkthdr.ts.tv_usec = hdr->tp_nsec / 1000;
+        pkthdr.caplen = hdr->tp_snaplen;
+        pkthdr.len = hdr->tp_len;
+        u_char *frame = (u_char*) hdr + hdr->tp_mac;
+
+        // Put the stripped VLAN tag back after the MAC addresses
+        if ((hdr->tp_status & TP_STATUS_VLAN_VALID) && pkthdr.caplen >= 12) {
+            uint16_t tpid = ETH_P_8021Q;
+#if defined(TP_STATUS_VLAN_TPID_VALID)
+            if (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) tpid = hdr->hv1.tp_vlan_tpid;
+#endif
+            uint16_t tci = hdr->hv1.tp_vlan_tci;
+
+            unsigned int copy = pkthdr.caplen < (unsigned int) snaplen ? pkthdr.caplen : snaplen;
+            memcpy(tagged, frame, 12);
+            tagged[12] = tpid >> 8;
+            tagged[13] = tpid & 0xff;
+            tagged[14] = tci >> 8;
+            tagged[15] = tci & 0xff;
+            memcpy(tagged + 16, frame + 12, copy - 12);
+            pkthdr.caplen = copy + 4;
+            pkthdr.len += 4;
+            frame = tagged;
+        }
+
+        handler(user, &pkthdr, frame);
+    }
+
+    // Give the block back to the kernel
+    __sync_synchronize();
+    block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    current = (current + 1) % RING_BLOCKS;
+
+    return num;
+}
@@ -0,0 +1,63 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <pcap.h>
+#include "capture.h"
+
+/* AF_PACKET TPACKET_V3 mmap ring capture
+ *
+ * Every instance owns its own ring. Instances sharing the same fanout
+ * group get the device traffic load balanced by flow hash, so each one
+ * can be drained by a different thread.
+ *
+ * Ethernet devices only. VLAN tags stripped by the kernel (or the NIC)
+ * are put back in the frames, as libpcap does.
+ */
+class RingCapture : public ICapture {
+  public:
+    RingCapture(const char *dev, int snaplen, int timeout, int fanout);
+    ~RingCapture();
+
+    bool open();
+    bool setFilter(const char *filter);
+    bool setDirection(capture_direction dir);
+    int datalink();
+    bool getStats(struct capture_stats *stats);
+    int dispatch(pcap_handler handler, u_char *user);
+
+  private:
+    const char *dev;
+    int snaplen;
+    int timeout;
+    int fanout;
+    capture_direction direction;
+
+    int fd;
+    u_char *ring;
+    unsigned int current;
+
+    // Copy of the first snaplen bytes of a frame with its VLAN tag back
+    u_char *tagged;
+
+    // Socket statistics are reset on every read, they are accumulated
+    // here. Interface drops are the device ones since the ring was open
+    struct capture_stats total;
+    uint64_t ifDroppedStart;
+
+    // returns the interface rx_dropped counter (0 if unknown)
+    uint64_t readIfDropped();
+};
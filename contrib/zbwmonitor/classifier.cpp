@@ -0,0 +1,29 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "classifier.h"
+#include <sys/socket.h>
+
+void NetClassifier::add(int family, const void *addr, int len, int index) {
+    if (family == AF_INET6) ipv6.add((const unsigned char*) addr, len, index);
+    else                    ipv4.add((const unsigned char*) addr, len, index);
+}
+
+void NetClassifier::build() {
+    ipv4.build();
+    ipv6.build();
+}
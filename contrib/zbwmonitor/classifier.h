@@ -0,0 +1,53 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(CLASSIFIER)
+#define CLASSIFIER
+
+#include <netinet/in.h>
+#include "packet.h"
+#include "prefixtrie.h"
+
+/* Internal networks classifier
+ *
+ * Keeps a prefix table per address family, so IPv4 lookups are not
+ * slowed down by the IPv6 prefixes (4 vs 16 trie levels).
+ */
+class NetClassifier {
+  public:
+    // Add an internal network (addr in network byte order), lookups of
+    // addresses inside it return index
+    void add(int family, const void *addr, int len, int index);
+
+    // Compile the added networks, must be called before any lookup
+    void build();
+
+    // returns the index of the internal network the address belongs
+    // to or -1 if it's external
+    int lookup(const struct in6_addr *addr) const;
+
+  private:
+    PrefixTrie ipv4;
+    PrefixTrie ipv6;
+};
+
+inline int NetClassifier::lookup(const struct in6_addr *addr) const {
+    if (isMappedIPv4(addr)) return ipv4.lookup(addr->s6_addr + 12);
+    return ipv6.lookup(addr->s6_addr);
+}
+
+#endif
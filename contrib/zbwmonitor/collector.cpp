@@ -0,0 +1,321 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "collector.h"
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+StatsCollector::StatsCollector(IBWStatsDumper *dumper, unsigned int capacity) {
+    this->dumper = dumper;
+    this->capacity = capacity;
+    topHosts = 0;
+    maxHosts = 0;
+    subnets = NULL;
+    vlans = false;
+    cardinality = false;
+    metrics = NULL;
+    dumpMetrics = false;
+    live = NULL;
+    exporter = NULL;
+    checkpoint = NULL;
+    checkpointTicks = 1;
+    dumpTicks = 1;
+    rateWidth = 0;
+    periodBase = 0;
+    total.reserve(capacity);
+    epoch = 0;
+    dumping = false;
+    memset(&next, 0, sizeof(next));
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cond, NULL);
+    pthread_cond_init(&idle, NULL);
+}
+
+void StatsCollector::setTopHosts(unsigned int k) {
+    topHosts = k;
+    total.setTopHosts(k);
+}
+
+void StatsCollector::setDumpTicks(unsigned int dumpTicks) {
+    this->dumpTicks = dumpTicks > 0 ? dumpTicks : 1;
+}
+
+void StatsCollector::setLive(SharedMemBWStatsDumper *live) {
+    this->live = live;
+}
+
+void StatsCollector::setExporter(OpenMetricsBWStatsDumper *exporter) {
+    this->exporter = exporter;
+}
+
+void StatsCollector::setCheckpoint(CheckpointBWStatsDumper *checkpoint, unsigned int ticks) {
+    this->checkpoint = checkpoint;
+    checkpointTicks = ticks > 0 ? ticks : 1;
+}
+
+unsigned int StatsCollector::restore() {
+    return checkpoint ? checkpoint->restore(&total) : 0;
+}
+
+void StatsCollector::setRates(unsigned int width) {
+    rateWidth = width;
+    total.setRates(dumpTicks, width, maxHosts > 0 && maxHosts < capacity ? maxHosts : capacity);
+}
+
+void StatsCollector::reschedule(unsigned int epoch, unsigned int dumpTicks,
+                                unsigned int checkpointTicks, unsigned int tick) {
+    pthread_mutex_lock(&lock);
+    next.epoch = epoch;
+    next.dumpTicks = dumpTicks > 0 ? dumpTicks : 1;
+    next.checkpointTicks = checkpointTicks > 0 ? checkpointTicks : 1;
+    next.tick = tick;
+    pthread_mutex_unlock(&lock);
+}
+
+void StatsCollector::setMaxHosts(unsigned int hosts) {
+    maxHosts = hosts;
+    total.setMaxHosts(hosts, this);
+}
+
+void StatsCollector::setSubnets(const SubnetLayout *subnets) {
+    this->subnets = subnets;
+    total.setSubnets(subnets);
+}
+
+void StatsCollector::setVLANs() {
+    vlans = true;
+    total.setVLANs();
+}
+
+void StatsCollector::setMetrics(Metrics *metrics, bool dump) {
+    this->metrics = metrics;
+    dumpMetrics = dump;
+}
+
+void StatsCollector::setCardinality() {
+    cardinality = true;
+}
+
+void StatsCollector::evictHost(HostStats *host) {
+    // The exporter keeps them in its totals, its counters never go back
+    if (exporter) exporter->addEvicted(host);
+
+    // Dumpers stream their output, nothing is kept meanwhile
+    beginDump();
+    dumper->dumpHost(host);
+    struct rate_summary summary;
+    if (total.getRates(host->getIP(), &summary)) dumper->dumpRates(host, &summary);
+}
+
+int StatsCollector::addWorker() {
+    pthread_mutex_lock(&lock);
+    int id = workers.size();
+    workers.push_back(0);
+    pthread_mutex_unlock(&lock);
+    return id;
+}
+
+void StatsCollector::removeWorker(int worker, BWStats *stats) {
+    pthread_mutex_lock(&lock);
+    if (worker == (int) workers.size() - 1) workers.pop_back();
+    spare.push_back(stats);
+    pthread_mutex_unlock(&lock);
+}
+
+BWStats* StatsCollector::getShard() {
+    BWStats *stats = NULL;
+
+    pthread_mutex_lock(&lock);
+    if (!spare.empty()) {
+        stats = spare.back();
+        spare.pop_back();
+    }
+    pthread_mutex_unlock(&lock);
+
+    // The collector is lagging behind, allocate a new one
+    if (stats == NULL) {
+        stats = new BWStats();
+        stats->reserve(maxHosts > 0 && maxHosts < capacity ? maxHosts : capacity);
+        if (topHosts > 0) stats->setTopHosts(topHosts);
+        if (subnets) stats->setSubnets(subnets);
+        if (vlans) stats->setVLANs();
+        if (cardinality) stats->setCardinality();
+    }
+    return stats;
+}
+
+BWStats* StatsCollector::swap(int worker, BWStats *stats, unsigned int epoch, unsigned int next) {
+    shard s;
+    s.stats = stats;
+    s.epoch = epoch;
+
+    pthread_mutex_lock(&lock);
+    pending.push_back(s);
+    workers[worker] = next;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    return getShard();
+}
+
+bool StatsCollector::start() {
+    if (pthread_create(&thread, NULL, thread_main, this) != 0) {
+        cerr << "Cannot create collector thread" << endl;
+        return false;
+    }
+    return true;
+}
+
+void StatsCollector::drain() {
+    pthread_mutex_lock(&lock);
+    while (!pending.empty() || finished(epoch)) {
+        pthread_cond_wait(&idle, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void StatsCollector::beginDump() {
+    if (!dumping) {
+        dumper->beginDump(time(NULL));
+        dumping = true;
+    }
+}
+
+void StatsCollector::dump() {
+    // Evicted hosts or finished flows may have begun it already
+    beginDump();
+    dumping = false;
+
+    if (metrics == NULL) {
+        total.dumpEntries(dumper);
+        dumper->endDump();
+        return;
+    }
+
+    struct metrics_snapshot snapshot;
+    struct timeval start, end;
+    if (dumpMetrics) metrics->snapshot(&snapshot);
+    gettimeofday(&start, NULL);
+    total.dumpEntries(dumper, true, dumpMetrics ? &snapshot : NULL);
+    dumper->endDump();
+    gettimeofday(&end, NULL);
+    metrics->addDump(elapsedUsecs(&start, &end));
+}
+
+void StatsCollector::updateExporter() {
+    if (metrics == NULL) {
+        total.dump(exporter, false);
+        return;
+    }
+
+    struct metrics_snapshot snapshot;
+    metrics->snapshot(&snapshot);
+    total.dump(exporter, false, &snapshot);
+}
+
+void *StatsCollector::thread_main(void *collector) {
+    ((StatsCollector*) collector)->run();
+    return NULL;
+}
+
+bool StatsCollector::finished(unsigned int epoch) {
+    for (vector<unsigned int>::iterator next = workers.begin(); next != workers.end(); ++next) {
+        if (*next <= epoch) return false;
+    }
+    return !workers.empty();
+}
+
+void StatsCollector::run() {
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        // Merge the shards of the epoch being collected, later ones wait
+        list<shard>::iterator it = pending.begin();
+        while (it != pending.end()) {
+            if (it->epoch > epoch) {
+                ++it;
+                continue;
+            }
+
+            BWStats *stats = it->stats;
+            it = pending.erase(it);
+            pthread_mutex_unlock(&lock);
+
+            // Finished flows go right away to the period dump
+            total.merge(stats);
+            if (stats->flowCount() > 0) {
+                beginDump();
+                stats->dumpFlows(dumper);
+            }
+            stats->clear();
+
+            pthread_mutex_lock(&lock);
+            spare.push_back(stats);
+        }
+
+        if (!finished(epoch)) {
+            if (pending.empty()) pthread_cond_broadcast(&idle);
+            pthread_cond_wait(&cond, &lock);
+            continue;
+        }
+
+        // All the shards of the epoch are in, publish them (unless later
+        // epochs are done too) and dump them if the period is over, or
+        // move on to the next rates bucket. The exporter adds up the
+        // periods, it always gets their last update
+        // A schedule change ends the period too
+        bool publish = live && !finished(epoch + 1);
+        bool switching = next.epoch != 0 && epoch + 1 >= next.epoch;
+        bool periodEnd = (epoch + 1 - periodBase) % dumpTicks == 0 || switching;
+        bool expose = exporter && (periodEnd || !finished(epoch + 1));
+        bool save = checkpoint && (periodEnd || (epoch + 1 - periodBase) % checkpointTicks == 0);
+        struct schedule s = next;
+        if (switching) next.epoch = 0;
+        pthread_mutex_unlock(&lock);
+        if (metrics) {
+            metrics->setHosts(total.hostCount(), total.hostCapacity());
+            metrics->tick();
+        }
+        if (publish) total.dump(live, false);
+        if (expose) updateExporter();
+        if (periodEnd) {
+            dump();
+            total.clear();
+            if (live) live->newPeriod();
+            if (exporter) exporter->newPeriod();
+        } else {
+            total.tick();
+        }
+        if (switching) {
+            dumpTicks = s.dumpTicks;
+            checkpointTicks = s.checkpointTicks;
+            periodBase = s.epoch;
+            if (rateWidth > 0) {
+                rateWidth = s.tick;
+                total.setRates(dumpTicks, rateWidth,
+                               maxHosts > 0 && maxHosts < capacity ? maxHosts : capacity);
+            }
+        }
+
+        // Once dumped the period is gone from the checkpoint too, so a
+        // restart doesn't count it twice
+        if (save) total.dump(checkpoint, false);
+        pthread_mutex_lock(&lock);
+        epoch++;
+    }
+}
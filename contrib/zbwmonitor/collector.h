@@ -0,0 +1,190 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(COLLECTOR)
+#define COLLECTOR
+
+#include <pthread.h>
+#include <list>
+#include <vector>
+#include "bwstats.h"
+#include "dumpers/shm.h"
+#include "dumpers/openmetrics.h"
+#include "dumpers/checkpoint.h"
+
+using namespace std;
+
+/* Stats collector
+ *
+ * Capture threads account packets in their own stats shard. When a dump
+ * period (epoch) ends they swap it for an empty one and keep capturing,
+ * while the collector thread merges the shards of the finished period,
+ * dumps them and recycles the shards for later periods.
+ *
+ * With live stats or host rates the epochs are shorter ticks: the merged
+ * stats are published and the host rates moved forward after each tick,
+ * and they are only dumped every dumpTicks ticks.
+ */
+class StatsCollector : public IHostSink {
+  public:
+    StatsCollector(IBWStatsDumper *dumper, unsigned int capacity);
+
+    // Only keep the top k hosts in the stats (before any getShard call)
+    void setTopHosts(unsigned int k);
+
+    // Only dump the stats every dumpTicks epochs
+    void setDumpTicks(unsigned int dumpTicks);
+
+    // Publish the stats to live after every epoch
+    void setLive(SharedMemBWStatsDumper *live);
+
+    // Expose the stats (and metrics, if set) to scrapes after every epoch
+    void setExporter(OpenMetricsBWStatsDumper *exporter);
+
+    // Save the stats of the current period to checkpoint every ticks
+    // epochs, and an empty checkpoint once they are dumped
+    void setCheckpoint(CheckpointBWStatsDumper *checkpoint, unsigned int ticks);
+
+    // Add the hosts of the last checkpoint to the current period (after
+    // setTopHosts and before start), returns their number
+    unsigned int restore();
+
+    // Keep host rates, one bucket of width seconds per epoch
+    void setRates(unsigned int width);
+
+    // From the given epoch on, dump every dumpTicks epochs of tick
+    // seconds and checkpoint every checkpointTicks (config reload). The
+    // period in progress is dumped before
+    void reschedule(unsigned int epoch, unsigned int dumpTicks,
+                    unsigned int checkpointTicks, unsigned int tick);
+
+    // Keep at most the given number of hosts in the merged stats, idle
+    // ones are dumped as they are evicted (see evictHost). Shards get
+    // room for that many hosts, workers hand them over early once full
+    void setMaxHosts(unsigned int hosts);
+
+    // Sum the traffic per subnet (before any getShard call)
+    void setSubnets(const SubnetLayout *subnets);
+
+    // Sum the traffic per VLAN (before any getShard call)
+    void setVLANs();
+
+    // Count distinct peers and ports per host (before any getShard call)
+    void setCardinality();
+
+    // Report the stats and dumps figures to metrics, and add them to the
+    // dumps if dump is set
+    void setMetrics(Metrics *metrics, bool dump);
+
+    // Evicted host, its counters so far go right away to the dump of the
+    // period, begun then if it wasn't (and to the exporter totals)
+    void evictHost(HostStats *host);
+
+    // Register a capture thread, returns its id
+    int addWorker();
+
+    // Unregister the last worker registered (it never started), its
+    // shard is kept as a spare one
+    void removeWorker(int worker, BWStats *stats);
+
+    // returns an empty shard, the worker sets its internal networks
+    BWStats* getShard();
+
+    // Hand over the shard filled by the worker during epoch, the worker
+    // is now in epoch next. Returns an empty shard to keep capturing
+    BWStats* swap(int worker, BWStats *stats, unsigned int epoch, unsigned int next);
+
+    // Start the collector thread
+    bool start();
+
+    // Wait until all the handed over shards are merged and dumped
+    void drain();
+
+  private:
+    struct shard {
+        BWStats *stats;
+        unsigned int epoch;
+    };
+
+    struct schedule {
+        unsigned int epoch;     // first epoch (0 if none pending)
+        unsigned int dumpTicks;
+        unsigned int checkpointTicks;
+        unsigned int tick;
+    };
+
+    IBWStatsDumper *dumper;
+    unsigned int capacity;
+    unsigned int topHosts;
+    unsigned int maxHosts;
+    const SubnetLayout *subnets;
+    bool vlans;
+    bool cardinality;
+    Metrics *metrics;
+    bool dumpMetrics;
+    SharedMemBWStatsDumper *live;
+    OpenMetricsBWStatsDumper *exporter;
+    CheckpointBWStatsDumper *checkpoint;
+    unsigned int checkpointTicks;
+    unsigned int dumpTicks;
+    unsigned int rateWidth;
+
+    // Periods are counted from this epoch on
+    unsigned int periodBase;
+
+    // Merged stats of the epoch being collected
+    BWStats total;
+    unsigned int epoch;
+
+    // The period dump was begun by an eviction or finished flows
+    bool dumping;
+
+    // Everything below is protected by lock
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t idle;
+    pthread_t thread;
+
+    // Shards waiting to be merged
+    list<shard> pending;
+
+    // Dump schedule change waiting for its epoch
+    struct schedule next;
+
+    // Empty shards ready to be used
+    vector<BWStats*> spare;
+
+    // Next epoch of each worker (all the previous ones were handed over)
+    vector<unsigned int> workers;
+
+    // returns true if all the workers finished the given epoch
+    bool finished(unsigned int epoch);
+
+    // Dump the merged stats (timed, with the metrics if set)
+    void dump();
+
+    // Begin the period dump, unless already begun
+    void beginDump();
+
+    // Update the exporter with the merged stats (and metrics)
+    void updateExporter();
+
+    void run();
+    static void *thread_main(void *collector);
+};
+
+#endif
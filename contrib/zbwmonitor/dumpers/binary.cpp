@@ -0,0 +1,191 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "binary.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace std;
+
+BinaryBWStatsDumper::BinaryBWStatsDumper(const char *path) {
+    this->path = path;
+    tmpPath = this->path + ".tmp";
+}
+
+void BinaryBWStatsDumper::beginDump(time_t timestamp) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BWDUMP_MAGIC, sizeof(header.magic));
+    header.version = BWDUMP_VERSION;
+    header.timestamp = timestamp;
+    header.recordSize = sizeof(struct bwdump_record);
+
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Error opening " << tmpPath << ": " << strerror(errno) << endl;
+        return;
+    }
+    out.setFd(fd);
+
+    // Record count is not known yet, header is written again at the end
+    out.write(&header, sizeof(header));
+}
+
+void BinaryBWStatsDumper::endDump() {
+    int fd = out.getFd();
+    if (fd < 0) return;
+
+    bool ok = out.flush();
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    ok = close(fd) == 0 && ok;
+    out.setFd(-1);
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        cerr << "Error writing " << path << ": " << strerror(errno) << endl;
+        unlink(tmpPath.c_str());
+    }
+}
+
+void BinaryBWStatsDumper::dumpHost(HostStats *host) {
+    struct bwdump_record rec;
+    hostRecord(&rec, BWDUMP_HOST, host);
+    add(&rec);
+}
+
+void BinaryBWStatsDumper::dumpTopHost(HostStats *host, unsigned long long error) {
+    struct bwdump_record rec;
+    hostRecord(&rec, BWDUMP_TOPHOST, host);
+    rec.host.error = error;
+    add(&rec);
+}
+
+void BinaryBWStatsDumper::dumpOther(HostStats *other, unsigned long long evicted,
+                                    unsigned long long threshold) {
+    struct bwdump_record rec;
+    hostRecord(&rec, BWDUMP_OTHER, other);
+    rec.host.error = threshold;
+    rec.host.evicted = evicted;
+    add(&rec);
+}
+
+void BinaryBWStatsDumper::dumpSubnet(HostStats *subnet, int len) {
+    struct bwdump_record rec;
+    hostRecord(&rec, BWDUMP_SUBNET, subnet);
+    rec.id = len;
+    add(&rec);
+}
+
+void BinaryBWStatsDumper::dumpVLAN(HostStats *vlan, unsigned int id) {
+    struct bwdump_record rec;
+    hostRecord(&rec, BWDUMP_VLAN, vlan);
+    rec.id = id;
+    add(&rec);
+}
+
+void BinaryBWStatsDumper::dumpMetrics(const struct metrics_snapshot *metrics) {
+    struct bwdump_record rec;
+
+    for (unsigned int i = 0; i < metrics->captures.size(); i++) {
+        const struct capture_summary *c = &metrics->captures[i];
+        memset(&rec, 0, sizeof(rec));
+        rec.type = BWDUMP_CAPTURE;
+        rec.id = i;
+        rec.capture.packets = c->counters.packets;
+        rec.capture.nonIP = c->counters.nonIP;
+        rec.capture.truncated = c->counters.truncated;
+        rec.capture.kernelRecv = c->counters.kernelRecv;
+        rec.capture.kernelDrops = c->counters.kernelDrops;
+        rec.capture.ifDrops = c->counters.ifDrops;
+        rec.capture.pps = c->pps;
+        rec.capture.decodeCycles = c->decodeCycles;
+        rec.capture.hostCycles = c->hostCycles;
+        rec.capture.flowCycles = c->flowCycles;
+        rec.capture.flows = c->counters.flows;
+        rec.capture.flowCapacity = c->counters.flowCapacity;
+        add(&rec);
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = BWDUMP_METRICS;
+    rec.metrics.hosts = metrics->hosts;
+    rec.metrics.hostCapacity = metrics->hostCapacity;
+    rec.metrics.lastDump = metrics->lastDump;
+    memcpy(rec.metrics.dumpLatency, metrics->dumpLatency, sizeof(rec.metrics.dumpLatency));
+    add(&rec);
+}
+
+void BinaryBWStatsDumper::dumpRates(HostStats *host, const struct rate_summary *rates) {
+    struct bwdump_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = BWDUMP_RATES;
+    rec.addr = *host->getIP();
+    rec.rates.peak = rates->peak;
+    rec.rates.avg = rates->avg;
+    rec.rates.p95 = rates->p95;
+    add(&rec);
+}
+
+void BinaryBWStatsDumper::dumpFlow(FlowStats *flow) {
+    const struct flow_key *key = flow->getKey();
+    struct bwdump_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = BWDUMP_FLOW;
+    rec.addr = key->src;
+    rec.flow.dst = key->dst;
+    rec.flow.sport = key->sport;
+    rec.flow.dport = key->dport;
+    rec.flow.proto = key->proto;
+    rec.flow.first = flow->getFirst();
+    rec.flow.last = flow->getLast();
+    rec.flow.packets = flow->getPackets();
+    rec.flow.bytes = flow->getBytes();
+    add(&rec);
+}
+
+void BinaryBWStatsDumper::hostRecord(struct bwdump_record *rec, uint32_t type, HostStats *host) {
+    BWSummary *sums[2] = { host->getInternalBW(), host->getExternalBW() };
+    struct bwdump_summary *recSums[2] = { &rec->host.internal, &rec->host.external };
+
+    memset(rec, 0, sizeof(*rec));
+    rec->type = type;
+    rec->addr = *host->getIP();
+    for (int i = 0; i < 2; i++) {
+        recSums[i]->sent = sums[i]->totalSent;
+        recSums[i]->recv = sums[i]->totalRecv;
+        recSums[i]->packets = sums[i]->numPackets;
+        recSums[i]->tcp = sums[i]->TCP;
+        recSums[i]->udp = sums[i]->UDP;
+        recSums[i]->icmp = sums[i]->ICMP;
+        rec->host.bytesCI[i] = sums[i]->bytesCI();
+        rec->host.packetsCI[i] = sums[i]->packetsCI();
+    }
+    if (!host->getPeers()->isEmpty()) {
+        rec->host.peers = host->getPeers()->estimate();
+        rec->host.ports = host->getPorts()->estimate();
+    }
+}
+
+void BinaryBWStatsDumper::add(const struct bwdump_record *rec) {
+    if (out.getFd() < 0) return;
+    out.write(rec, sizeof(*rec));
+    header.records++;
+}
@@ -0,0 +1,154 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(BINARYDUMPER)
+#define BINARYDUMPER
+
+#include <stdint.h>
+#include <string>
+#include "../bwstats.h"
+#include "output.h"
+
+using namespace std;
+
+/* Binary dump file format
+ *
+ * A header followed by header.records fixed size records, all in host
+ * byte order, so the file can be mmapped and read as an array. Each dump
+ * replaces the whole file (written aside and renamed), readers always
+ * see a complete dump.
+ */
+
+const char BWDUMP_MAGIC[4] = { 'Z', 'B', 'W', 'D' };
+const uint32_t BWDUMP_VERSION = 2;
+
+enum bwdump_type {
+    BWDUMP_HOST = 1,        // host counters
+    BWDUMP_TOPHOST = 2,     // top-K host counters, with error
+    BWDUMP_OTHER = 3,       // top-K evicted hosts, with evicted and threshold
+    BWDUMP_FLOW = 4,        // flow counters
+    BWDUMP_RATES = 5,       // rates of the previous host
+    BWDUMP_SUBNET = 6,      // subnet counters, with id (prefix length)
+    BWDUMP_VLAN = 7,        // VLAN counters, with id
+    BWDUMP_CAPTURE = 8,     // capture thread metrics, with id
+    BWDUMP_METRICS = 9      // stats and dumps metrics
+};
+
+struct bwdump_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t timestamp;
+    uint32_t recordSize;    // sizeof(struct bwdump_record)
+    uint32_t records;
+    uint8_t reserved[40];
+};
+
+struct bwdump_summary {
+    uint64_t sent;
+    uint64_t recv;
+    uint64_t packets;
+    uint64_t tcp;
+    uint64_t udp;
+    uint64_t icmp;
+};
+
+struct bwdump_record {
+    uint32_t type;
+    uint32_t id;                // subnet prefix length, VLAN id
+    struct in6_addr addr;       // host or subnet (IPv4-mapped for IPv4), flow source
+    union {
+        struct {
+            struct bwdump_summary internal;
+            struct bwdump_summary external;
+            uint64_t error;     // top-K host error, other threshold
+            uint64_t evicted;   // other only
+            uint64_t bytesCI[2];    // sampling 95% confidence intervals
+            uint64_t packetsCI[2];  // (internal, external), 0 if not randomly sampled
+            uint64_t peers;     // distinct external peers and ports
+            uint64_t ports;     // (estimates), 0 if not counted
+        } host;
+        struct {
+            uint64_t packets;
+            uint64_t nonIP;
+            uint64_t truncated;
+            uint64_t kernelRecv;
+            uint64_t kernelDrops;
+            uint64_t ifDrops;
+            uint64_t pps;
+            uint64_t decodeCycles;  // per packet
+            uint64_t hostCycles;
+            uint64_t flowCycles;
+            uint32_t flows;
+            uint32_t flowCapacity;
+        } capture;
+        struct {
+            uint32_t hosts;
+            uint32_t hostCapacity;
+            uint64_t lastDump;      // microseconds
+            uint64_t dumpLatency[METRICS_LATENCY_BUCKETS];
+        } metrics;
+        struct {
+            uint64_t peak;      // bits per second
+            uint64_t avg;
+            uint64_t p95;
+        } rates;
+        struct {
+            struct in6_addr dst;
+            uint16_t sport;
+            uint16_t dport;
+            uint8_t proto;
+            uint8_t pad[3];
+            uint32_t first;
+            uint32_t last;
+            uint64_t packets;
+            uint64_t bytes;
+        } flow;
+    };
+};
+
+
+/* Binary dumper, see the format above */
+class BinaryBWStatsDumper : public IBWStatsDumper {
+  public:
+    BinaryBWStatsDumper(const char *path);
+
+    void beginDump(time_t timestamp);
+    void dumpHost(HostStats *host);
+    void dumpRates(HostStats *host, const struct rate_summary *rates);
+    void dumpFlow(FlowStats *flow);
+    void dumpTopHost(HostStats *host, unsigned long long error);
+    void dumpOther(HostStats *other, unsigned long long evicted,
+                   unsigned long long threshold);
+    void dumpSubnet(HostStats *subnet, int len);
+    void dumpVLAN(HostStats *vlan, unsigned int id);
+    void dumpMetrics(const struct metrics_snapshot *metrics);
+    void endDump();
+
+  private:
+    string path;
+    string tmpPath;
+    OutputBuffer out;
+    struct bwdump_header header;
+
+    // Fill a host record
+    void hostRecord(struct bwdump_record *rec, uint32_t type, HostStats *host);
+
+    // Append a record to the dump
+    void add(const struct bwdump_record *rec);
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "checkpoint.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+
+using namespace std;
+
+CheckpointBWStatsDumper::CheckpointBWStatsDumper(const char *path, unsigned int capacity) {
+    this->path = path;
+    this->capacity = capacity;
+    size = sizeof(struct checkpoint_header) + 2 * capacity * sizeof(struct checkpoint_host);
+    header = NULL;
+    areas[0] = areas[1] = NULL;
+    area = 0;
+    count = 0;
+    dropped = 0;
+    timestamp = 0;
+}
+
+CheckpointBWStatsDumper::~CheckpointBWStatsDumper() {
+    if (header != NULL) munmap(header, size);
+}
+
+bool CheckpointBWStatsDumper::open() {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        cerr << "Error opening " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    // A checkpoint of another size can't be mapped as is, start over
+    struct stat st;
+    bool keep = fstat(fd, &st) == 0 && (size_t) st.st_size == size;
+    if (!keep && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+        cerr << "Error sizing " << path << ": " << strerror(errno) << endl;
+        close(fd);
+        return false;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        cerr << "Error mapping " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    header = (struct checkpoint_header*) mem;
+    areas[0] = (struct checkpoint_host*) (header + 1);
+    areas[1] = areas[0] + capacity;
+
+    if (!isValid()) {
+        if (keep) cerr << "Ignoring incompatible checkpoint " << path << endl;
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+        header->version = CHECKPOINT_VERSION;
+        header->recordSize = sizeof(struct checkpoint_host);
+        header->capacity = capacity;
+        msync(header, sizeof(*header), MS_SYNC);
+    }
+    return true;
+}
+
+bool CheckpointBWStatsDumper::isValid() {
+    return memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == CHECKPOINT_VERSION &&
+           header->recordSize == sizeof(struct checkpoint_host) &&
+           header->capacity == capacity &&
+           header->area < 2 &&
+           header->hosts[header->area] <= capacity;
+}
+
+unsigned int CheckpointBWStatsDumper::restore(BWStats *stats) {
+    if (header == NULL) return 0;
+
+    const struct checkpoint_host *recs = areas[header->area];
+    unsigned int n = header->hosts[header->area];
+    for (unsigned int i = 0; i < n; i++) {
+        const struct checkpoint_host *rec = &recs[i];
+        const struct bwdump_summary *recSums[2] = { &rec->internal, &rec->external };
+        HostStats host(&rec->addr);
+        BWSummary *sums[2] = { host.getInternalBW(), host.getExternalBW() };
+
+        for (int j = 0; j < 2; j++) {
+            sums[j]->totalSent = recSums[j]->sent;
+            sums[j]->totalRecv = recSums[j]->recv;
+            sums[j]->numPackets = recSums[j]->packets;
+            sums[j]->TCP = recSums[j]->tcp;
+            sums[j]->UDP = recSums[j]->udp;
+            sums[j]->ICMP = recSums[j]->icmp;
+            sums[j]->bytesVar = rec->variance[j * 2];
+            sums[j]->packetsVar = rec->variance[j * 2 + 1];
+        }
+        stats->restore(&host, rec->error);
+    }
+    return n;
+}
+
+void CheckpointBWStatsDumper::beginDump(time_t timestamp) {
+    if (header == NULL) return;
+
+    // Write over the older checkpoint
+    area = 1 - header->area;
+    count = 0;
+    dropped = 0;
+    this->timestamp = timestamp;
+}
+
+void CheckpointBWStatsDumper::dumpHost(HostStats *host) {
+    dumpTopHost(host, 0);
+}
+
+void CheckpointBWStatsDumper::dumpTopHost(HostStats *host, unsigned long long error) {
+    if (header == NULL) return;
+    if (count == capacity) {
+        dropped++;
+        return;
+    }
+
+    BWSummary *sums[2] = { host->getInternalBW(), host->getExternalBW() };
+    struct checkpoint_host rec;
+    struct bwdump_summary *recSums[2] = { &rec.internal, &rec.external };
+
+    memset(&rec, 0, sizeof(rec));
+    rec.addr = *host->getIP();
+    for (int i = 0; i < 2; i++) {
+        recSums[i]->sent = sums[i]->totalSent;
+        recSums[i]->recv = sums[i]->totalRecv;
+        recSums[i]->packets = sums[i]->numPackets;
+        recSums[i]->tcp = sums[i]->TCP;
+        recSums[i]->udp = sums[i]->UDP;
+        recSums[i]->icmp = sums[i]->ICMP;
+        rec.variance[i * 2] = sums[i]->bytesVar;
+        rec.variance[i * 2 + 1] = sums[i]->packetsVar;
+    }
+    rec.error = error;
+
+    // Unchanged records don't dirty their page
+    struct checkpoint_host *dst = &areas[area][count++];
+    if (memcmp(dst, &rec, sizeof(rec)) != 0) *dst = rec;
+}
+
+void CheckpointBWStatsDumper::endDump() {
+    if (header == NULL) return;
+    if (dropped > 0) {
+        cerr << "Checkpoint full, " << dropped << " hosts left out" << endl;
+    }
+
+    // Records must be on disk before the header points to them
+    if (count > 0) {
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t) areas[area] & ~(page - 1);
+        uintptr_t end = (uintptr_t) (areas[area] + count);
+        msync((void*) start, end - start, MS_SYNC);
+    }
+
+    header->hosts[area] = count;
+    header->timestamp[area] = timestamp;
+    header->area = area;
+    msync(header, sizeof(*header), MS_SYNC);
+}
@@ -0,0 +1,110 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(CHECKPOINTDUMPER)
+#define CHECKPOINTDUMPER
+
+#include <stdint.h>
+#include <string>
+#include "../bwstats.h"
+#include "binary.h"
+
+using namespace std;
+
+/* Checkpoint file of the current dump period counters
+ *
+ * A header followed by two areas of header.capacity host records, host
+ * byte order, mmapped by the daemon. Checkpoints alternate between the
+ * areas: records are written to the one not in use, flushed to disk, and
+ * only then header.area points to it. A crash at any time leaves the
+ * previous checkpoint complete.
+ *
+ * Records equal to the ones already in the area are not written, so the
+ * pages of idle hosts stay clean and each checkpoint only writes back
+ * what changed.
+ */
+
+const char CHECKPOINT_MAGIC[4] = { 'Z', 'B', 'W', 'C' };
+const uint32_t CHECKPOINT_VERSION = 1;
+
+struct checkpoint_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t recordSize;        // sizeof(struct checkpoint_host)
+    uint32_t capacity;          // records room of each area
+    uint32_t area;              // last complete checkpoint (0 or 1)
+    uint32_t hosts[2];          // records in use of each area
+    uint32_t reserved;
+    uint64_t timestamp[2];      // checkpoint time of each area
+    uint8_t pad[16];
+};
+
+struct checkpoint_host {
+    struct in6_addr addr;       // IPv4-mapped for IPv4
+    struct bwdump_summary internal;
+    struct bwdump_summary external;
+    double variance[4];         // sampling: internal bytes and packets,
+                                // external bytes and packets
+    uint64_t error;             // top-K error
+};
+
+
+/* Saves the stats in the checkpoint file and loads them back */
+class CheckpointBWStatsDumper : public IBWStatsDumper {
+  public:
+    // File path and max number of hosts
+    CheckpointBWStatsDumper(const char *path, unsigned int capacity);
+    ~CheckpointBWStatsDumper();
+
+    // Map the file, a previous checkpoint is kept if compatible.
+    // returns false on error
+    bool open();
+
+    // Add the hosts of the last checkpoint to stats, returns their number
+    unsigned int restore(BWStats *stats);
+
+    void beginDump(time_t timestamp);
+    void dumpHost(HostStats *host);
+    void dumpRates(HostStats *host, const struct rate_summary *rates) {};
+    void dumpFlow(FlowStats *flow) {};
+    void dumpTopHost(HostStats *host, unsigned long long error);
+    void dumpOther(HostStats *other, unsigned long long evicted,
+                   unsigned long long threshold) {};
+    void dumpSubnet(HostStats *subnet, int len) {};
+    void dumpVLAN(HostStats *vlan, unsigned int id) {};
+    void dumpMetrics(const struct metrics_snapshot *metrics) {};
+    void endDump();
+
+  private:
+    string path;
+    unsigned int capacity;
+    size_t size;
+
+    struct checkpoint_header *header;
+    struct checkpoint_host *areas[2];
+
+    // Checkpoint being written: area, records and hosts left out
+    unsigned int area;
+    unsigned int count;
+    unsigned int dropped;
+    time_t timestamp;
+
+    // returns true if the mapped file holds a compatible checkpoint
+    bool isValid();
+};
+
+#endif
@@ -16,34 +16,159 @@
 */
 
 #include "console.h"
+#include "output.h"
 #include <arpa/inet.h>
 #include <time.h>
 
 using namespace std;
 
-void ConsoleBWStatsDumper::dumpHost(HostStats *host) {
-    char ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(host->getIP()), ip, INET_ADDRSTRLEN);
+void ConsoleBWStatsDumper::beginDump(time_t timestamp) {
+    this->timestamp = timestamp;
+}
 
-    time_t rawtime;
-    time(&rawtime);
+void ConsoleBWStatsDumper::endDump() {
+    out->flush();
+}
 
+// Print the counters of a host
+static void printCounters(ostream &out, HostStats *host) {
     BWSummary* internal = host->getInternalBW();
     BWSummary* external = host->getExternalBW();
 
-    cout << "IP=" << ip;
-    cout << " TIMESTAMP=" << rawtime;
-    cout << " INT_SENT=" << internal->totalSent;
-    cout << " INT_RECV=" << internal->totalRecv;
-    cout << " INT_TCP="  << internal->TCP;
-    cout << " INT_UDP="  << internal->UDP;
-    cout << " INT_ICMP=" << internal->ICMP;
+    out << " INT_SENT=" << internal->totalSent;
+    out << " INT_RECV=" << internal->totalRecv;
+    out << " INT_TCP="  << internal->TCP;
+    out << " INT_UDP="  << internal->UDP;
+    out << " INT_ICMP=" << internal->ICMP;
+
+    out << " EXT_SENT=" << external->totalSent;
+    out << " EXT_RECV=" << external->totalRecv;
+    out << " EXT_TCP="  << external->TCP;
+    out << " EXT_UDP="  << external->UDP;
+    out << " EXT_ICMP=" << external->ICMP;
+
+    // Sampled traffic, 95% confidence intervals of the estimates
+    if (internal->packetsVar > 0 || external->packetsVar > 0) {
+        out << " INT_BYTES_CI=" << internal->bytesCI();
+        out << " INT_PACKETS_CI=" << internal->packetsCI();
+        out << " EXT_BYTES_CI=" << external->bytesCI();
+        out << " EXT_PACKETS_CI=" << external->packetsCI();
+    }
+
+    // Distinct external peers and ports (estimates)
+    if (!host->getPeers()->isEmpty()) {
+        out << " PEERS=" << host->getPeers()->estimate();
+        out << " PORTS=" << host->getPorts()->estimate();
+    }
+}
+
+void ConsoleBWStatsDumper::dumpHost(HostStats *host) {
+    char ip[INET6_ADDRSTRLEN];
+    formatIP(host->getIP(), ip);
+
+    *out << "IP=" << ip;
+    *out << " TIMESTAMP=" << timestamp;
+    printCounters(*out, host);
+    *out << '\n';
+}
+
+void ConsoleBWStatsDumper::dumpTopHost(HostStats *host, unsigned long long error) {
+    char ip[INET6_ADDRSTRLEN];
+    formatIP(host->getIP(), ip);
+
+    *out << "IP=" << ip;
+    *out << " TIMESTAMP=" << timestamp;
+    printCounters(*out, host);
+    *out << " ERROR=" << error;
+    *out << '\n';
+}
 
-    cout << " EXT_SENT=" << external->totalSent;
-    cout << " EXT_RECV=" << external->totalRecv;
-    cout << " EXT_TCP="  << external->TCP;
-    cout << " EXT_UDP="  << external->UDP;
-    cout << " EXT_ICMP=" << external->ICMP;
-    cout << endl;
+void ConsoleBWStatsDumper::dumpOther(HostStats *other, unsigned long long evicted,
+                                     unsigned long long threshold) {
+    *out << "IP=OTHER";
+    *out << " TIMESTAMP=" << timestamp;
+    printCounters(*out, other);
+    *out << " EVICTED=" << evicted;
+    *out << " THRESHOLD=" << threshold;
+    *out << '\n';
 }
 
+void ConsoleBWStatsDumper::dumpSubnet(HostStats *subnet, int len) {
+    char ip[INET6_ADDRSTRLEN];
+    formatIP(subnet->getIP(), ip);
+
+    *out << "SUBNET=" << ip << "/" << len;
+    *out << " TIMESTAMP=" << timestamp;
+    printCounters(*out, subnet);
+    *out << '\n';
+}
+
+void ConsoleBWStatsDumper::dumpVLAN(HostStats *vlan, unsigned int id) {
+    *out << "VLAN=" << id;
+    *out << " TIMESTAMP=" << timestamp;
+    printCounters(*out, vlan);
+    *out << '\n';
+}
+
+void ConsoleBWStatsDumper::dumpMetrics(const struct metrics_snapshot *metrics) {
+    for (unsigned int i = 0; i < metrics->captures.size(); i++) {
+        const struct capture_summary *c = &metrics->captures[i];
+        *out << "METRICS CAPTURE=" << i;
+        *out << " TIMESTAMP=" << timestamp;
+        *out << " PACKETS=" << c->counters.packets;
+        *out << " NON_IP=" << c->counters.nonIP;
+        *out << " TRUNCATED=" << c->counters.truncated;
+        *out << " KERNEL_RECV=" << c->counters.kernelRecv;
+        *out << " KERNEL_DROPS=" << c->counters.kernelDrops;
+        *out << " IF_DROPS=" << c->counters.ifDrops;
+        *out << " PPS=" << c->pps;
+        *out << " DECODE_CYCLES=" << c->decodeCycles;
+        *out << " HOST_CYCLES=" << c->hostCycles;
+        *out << " FLOW_CYCLES=" << c->flowCycles;
+        *out << " FLOWS=" << c->counters.flows;
+        *out << " FLOW_CAPACITY=" << c->counters.flowCapacity;
+        *out << '\n';
+    }
+
+    *out << "METRICS TIMESTAMP=" << timestamp;
+    *out << " HOSTS=" << metrics->hosts;
+    *out << " HOST_CAPACITY=" << metrics->hostCapacity;
+    *out << " LAST_DUMP_US=" << metrics->lastDump;
+    *out << " DUMP_LATENCY=";
+    for (unsigned int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        if (i > 0) *out << ',';
+        *out << metrics->dumpLatency[i];
+    }
+    *out << '\n';
+}
+
+void ConsoleBWStatsDumper::dumpRates(HostStats *host, const struct rate_summary *rates) {
+    char ip[INET6_ADDRSTRLEN];
+    formatIP(host->getIP(), ip);
+
+    *out << "RATE IP=" << ip;
+    *out << " TIMESTAMP=" << timestamp;
+    *out << " PEAK_BPS=" << rates->peak;
+    *out << " AVG_BPS=" << rates->avg;
+    *out << " P95_BPS=" << rates->p95;
+    *out << '\n';
+}
+
+void ConsoleBWStatsDumper::dumpFlow(FlowStats *flow) {
+    const struct flow_key *key = flow->getKey();
+    char src[INET6_ADDRSTRLEN];
+    char dst[INET6_ADDRSTRLEN];
+    formatIP(&key->src, src);
+    formatIP(&key->dst, dst);
+
+    *out << "FLOW SRC=" << src;
+    *out << " DST=" << dst;
+    *out << " PROTO=" << (int) key->proto;
+    *out << " SPORT=" << key->sport;
+    *out << " DPORT=" << key->dport;
+    *out << " START=" << flow->getFirst();
+    *out << " END=" << flow->getLast();
+    *out << " PACKETS=" << flow->getPackets();
+    *out << " BYTES=" << flow->getBytes();
+    *out << '\n';
+}
@@ -24,7 +24,22 @@ using namespace std;
 /* Bandwidth usage container */
 class ConsoleBWStatsDumper : public IBWStatsDumper {
   public:
-    ConsoleBWStatsDumper() {};
+    // Write to the given stream (stdout by default)
+    ConsoleBWStatsDumper(ostream &out = cout) { this->out = &out; timestamp = 0; };
+    void beginDump(time_t timestamp);
     void dumpHost(HostStats *host);
+    void dumpRates(HostStats *host, const struct rate_summary *rates);
+    void dumpFlow(FlowStats *flow);
+    void dumpTopHost(HostStats *host, unsigned long long error);
+    void dumpOther(HostStats *other, unsigned long long evicted,
+                   unsigned long long threshold);
+    void dumpSubnet(HostStats *subnet, int len);
+    void dumpVLAN(HostStats *vlan, unsigned int id);
+    void dumpMetrics(const struct metrics_snapshot *metrics);
+    void endDump();
+
+  private:
+    ostream *out;
+    time_t timestamp;
 };
 
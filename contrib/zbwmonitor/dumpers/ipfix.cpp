@@ -0,0 +1,354 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ipfix.h"
+#include <errno.h>
+#include <endian.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <iostream>
+
+using namespace std;
+
+const uint16_t IPFIX_VERSION = 10;
+const unsigned int IPFIX_HEADER_LEN = 16;
+const unsigned int IPFIX_SET_HEADER_LEN = 4;
+const uint16_t IPFIX_TEMPLATE_SET = 2;
+
+// Reverse information elements (RFC 5103), enterprise bit and PEN
+const uint16_t IPFIX_ENTERPRISE = 0x8000;
+const uint32_t IPFIX_REVERSE_PEN = 29305;
+
+// Information elements used
+enum {
+    IE_OCTETS = 1,
+    IE_PACKETS = 2,
+    IE_PROTOCOL = 4,
+    IE_SRC_PORT = 7,
+    IE_SRC_IPV4 = 8,
+    IE_DST_PORT = 11,
+    IE_DST_IPV4 = 12,
+    IE_SRC_IPV6 = 27,
+    IE_DST_IPV6 = 28,
+    IE_START_SECONDS = 150,
+    IE_END_SECONDS = 151
+};
+
+struct ipfix_field {
+    uint16_t id;
+    uint16_t length;
+};
+
+#define FIELDS(f) (sizeof(f) / sizeof(f[0]))
+
+const struct ipfix_field HOST4_FIELDS[] = {
+    { IE_SRC_IPV4, 4 }, { IE_START_SECONDS, 4 }, { IE_END_SECONDS, 4 },
+    { IE_OCTETS, 8 }, { IPFIX_ENTERPRISE | IE_OCTETS, 8 }, { IE_PACKETS, 8 }
+};
+const struct ipfix_field HOST6_FIELDS[] = {
+    { IE_SRC_IPV6, 16 }, { IE_START_SECONDS, 4 }, { IE_END_SECONDS, 4 },
+    { IE_OCTETS, 8 }, { IPFIX_ENTERPRISE | IE_OCTETS, 8 }, { IE_PACKETS, 8 }
+};
+const struct ipfix_field FLOW4_FIELDS[] = {
+    { IE_SRC_IPV4, 4 }, { IE_DST_IPV4, 4 }, { IE_SRC_PORT, 2 }, { IE_DST_PORT, 2 },
+    { IE_PROTOCOL, 1 }, { IE_START_SECONDS, 4 }, { IE_END_SECONDS, 4 },
+    { IE_OCTETS, 8 }, { IE_PACKETS, 8 }
+};
+const struct ipfix_field FLOW6_FIELDS[] = {
+    { IE_SRC_IPV6, 16 }, { IE_DST_IPV6, 16 }, { IE_SRC_PORT, 2 }, { IE_DST_PORT, 2 },
+    { IE_PROTOCOL, 1 }, { IE_START_SECONDS, 4 }, { IE_END_SECONDS, 4 },
+    { IE_OCTETS, 8 }, { IE_PACKETS, 8 }
+};
+
+// Record sizes of the templates above
+const unsigned int HOST4_LEN = 36;
+const unsigned int HOST6_LEN = 48;
+const unsigned int FLOW4_LEN = 37;
+const unsigned int FLOW6_LEN = 61;
+
+// Big endian writers, return the next position
+static inline u_char* put8(u_char *p, uint8_t v) {
+    *p = v;
+    return p + 1;
+}
+
+static inline u_char* put16(u_char *p, uint16_t v) {
+    v = htons(v);
+    memcpy(p, &v, 2);
+    return p + 2;
+}
+
+static inline u_char* put32(u_char *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, 4);
+    return p + 4;
+}
+
+static inline u_char* put64(u_char *p, uint64_t v) {
+    v = htobe64(v);
+    memcpy(p, &v, 8);
+    return p + 8;
+}
+
+// IPv4 (from the mapped address) or IPv6 address
+static inline u_char* putAddr(u_char *p, const struct in6_addr *addr, bool v4) {
+    if (v4) {
+        memcpy(p, addr->s6_addr + 12, 4);
+        return p + 4;
+    }
+    memcpy(p, addr->s6_addr, 16);
+    return p + 16;
+}
+
+IPFIXBWStatsDumper::IPFIXBWStatsDumper(const char *address, unsigned int templateRefresh) {
+    this->address = address;
+    this->templateRefresh = templateRefresh;
+    fd = -1;
+
+    buffers = new u_char[IPFIX_BATCH * IPFIX_MTU];
+    memset(msgs, 0, sizeof(msgs));
+    for (unsigned int i = 0; i < IPFIX_BATCH; i++) {
+        iovs[i].iov_base = buffers + i * IPFIX_MTU;
+        iovs[i].iov_len = 0;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    queued = 0;
+
+    msg = NULL;
+    used = 0;
+    records = 0;
+    set = NULL;
+    setId = 0;
+
+    sequence = 0;
+    timestamp = 0;
+    periodStart = time(NULL);
+    templatesTime = 0;
+    dropped = 0;
+}
+
+IPFIXBWStatsDumper::~IPFIXBWStatsDumper() {
+    if (fd >= 0) close(fd);
+    delete[] buffers;
+}
+
+bool IPFIXBWStatsDumper::open() {
+    // host:port, IPv6 hosts in brackets
+    string host = address;
+    size_t colon = host.rfind(':');
+    if (colon == string::npos) {
+        cerr << "Port missing in " << address << endl;
+        return false;
+    }
+    string port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+    if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (err != 0) {
+        cerr << "Cannot resolve " << address << ": " << gai_strerror(err) << endl;
+        return false;
+    }
+
+    fd = socket(res->ai_family, SOCK_DGRAM, 0);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        cerr << "Error connecting to " << address << ": " << strerror(errno) << endl;
+        freeaddrinfo(res);
+        return false;
+    }
+    freeaddrinfo(res);
+
+    // Room for a few batches in flight
+    int sndbuf = IPFIX_BATCH * IPFIX_MTU * 4;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    return true;
+}
+
+void IPFIXBWStatsDumper::beginDump(time_t timestamp) {
+    this->timestamp = timestamp;
+    if (templatesTime == 0 || timestamp - templatesTime >= (time_t) templateRefresh) {
+        sendTemplates();
+        templatesTime = timestamp;
+    }
+}
+
+void IPFIXBWStatsDumper::endDump() {
+    if (msg != NULL) finishMessage();
+    flush();
+    periodStart = timestamp;
+
+    if (dropped > 0) {
+        cerr << "IPFIX export to " << address << ": " << dropped << " datagrams dropped" << endl;
+        dropped = 0;
+    }
+}
+
+void IPFIXBWStatsDumper::dumpHost(HostStats *host) {
+    const struct in6_addr *ip = host->getIP();
+    bool v4 = isMappedIPv4(ip);
+    BWSummary *sums[2] = { host->getInternalBW(), host->getExternalBW() };
+    uint16_t ids[2] = { v4 ? IPFIX_HOST_INT4 : IPFIX_HOST_INT6,
+                        v4 ? IPFIX_HOST_EXT4 : IPFIX_HOST_EXT6 };
+
+    for (int i = 0; i < 2; i++) {
+        if (sums[i]->numPackets == 0) continue;
+
+        u_char *p = reserve(ids[i], v4 ? HOST4_LEN : HOST6_LEN);
+        p = putAddr(p, ip, v4);
+        p = put32(p, periodStart);
+        p = put32(p, timestamp);
+        p = put64(p, sums[i]->totalSent);
+        p = put64(p, sums[i]->totalRecv);
+        put64(p, sums[i]->numPackets);
+    }
+}
+
+void IPFIXBWStatsDumper::dumpTopHost(HostStats *host, unsigned long long error) {
+    dumpHost(host);
+}
+
+void IPFIXBWStatsDumper::dumpFlow(FlowStats *flow) {
+    const struct flow_key *key = flow->getKey();
+    bool v4 = flow->isIPv4();
+
+    u_char *p = reserve(v4 ? IPFIX_FLOW4 : IPFIX_FLOW6, v4 ? FLOW4_LEN : FLOW6_LEN);
+    p = putAddr(p, &key->src, v4);
+    p = putAddr(p, &key->dst, v4);
+    p = put16(p, key->sport);
+    p = put16(p, key->dport);
+    p = put8(p, key->proto);
+    p = put32(p, flow->getFirst());
+    p = put32(p, flow->getLast());
+    p = put64(p, flow->getBytes());
+    put64(p, flow->getPackets());
+}
+
+void IPFIXBWStatsDumper::sendTemplates() {
+    struct {
+        uint16_t id;
+        const struct ipfix_field *fields;
+        unsigned int count;
+    } templates[] = {
+        { IPFIX_HOST_INT4, HOST4_FIELDS, FIELDS(HOST4_FIELDS) },
+        { IPFIX_HOST_INT6, HOST6_FIELDS, FIELDS(HOST6_FIELDS) },
+        { IPFIX_HOST_EXT4, HOST4_FIELDS, FIELDS(HOST4_FIELDS) },
+        { IPFIX_HOST_EXT6, HOST6_FIELDS, FIELDS(HOST6_FIELDS) },
+        { IPFIX_FLOW4, FLOW4_FIELDS, FIELDS(FLOW4_FIELDS) },
+        { IPFIX_FLOW6, FLOW6_FIELDS, FIELDS(FLOW6_FIELDS) }
+    };
+
+    if (msg != NULL) finishMessage();
+    for (unsigned int i = 0; i < FIELDS(templates); i++) {
+        unsigned int len = 4;
+        for (unsigned int j = 0; j < templates[i].count; j++) {
+            len += templates[i].fields[j].id & IPFIX_ENTERPRISE ? 8 : 4;
+        }
+
+        u_char *p = reserve(IPFIX_TEMPLATE_SET, len);
+        p = put16(p, templates[i].id);
+        p = put16(p, templates[i].count);
+        for (unsigned int j = 0; j < templates[i].count; j++) {
+            const struct ipfix_field *f = &templates[i].fields[j];
+            p = put16(p, f->id);
+            p = put16(p, f->length);
+            if (f->id & IPFIX_ENTERPRISE) p = put32(p, IPFIX_REVERSE_PEN);
+        }
+    }
+    finishMessage();
+}
+
+u_char* IPFIXBWStatsDumper::reserve(uint16_t id, unsigned int len) {
+    if (msg == NULL) startMessage();
+
+    // A new set for other templates, or a new message if full
+    if (id != setId || used + len > IPFIX_MTU) {
+        closeSet();
+        if (used + IPFIX_SET_HEADER_LEN + len > IPFIX_MTU) {
+            finishMessage();
+            startMessage();
+        }
+        set = msg + used;
+        put16(set, id);
+        setId = id;
+        used += IPFIX_SET_HEADER_LEN;
+    }
+
+    u_char *p = msg + used;
+    used += len;
+    if (id != IPFIX_TEMPLATE_SET) records++;
+    return p;
+}
+
+void IPFIXBWStatsDumper::closeSet() {
+    if (setId == 0) return;
+    put16(set + 2, msg + used - set);
+    setId = 0;
+}
+
+void IPFIXBWStatsDumper::startMessage() {
+    msg = buffers + queued * IPFIX_MTU;
+    used = IPFIX_HEADER_LEN;
+    records = 0;
+    setId = 0;
+}
+
+void IPFIXBWStatsDumper::finishMessage() {
+    closeSet();
+
+    // Sequence counts the data records of the previous messages
+    u_char *p = put16(msg, IPFIX_VERSION);
+    p = put16(p, used);
+    p = put32(p, timestamp);
+    p = put32(p, sequence);
+    put32(p, 0); // observation domain
+    sequence += records;
+
+    iovs[queued].iov_len = used;
+    queued++;
+    msg = NULL;
+    if (queued == IPFIX_BATCH) flush();
+}
+
+void IPFIXBWStatsDumper::flush() {
+    unsigned int sent = 0;
+    while (sent < queued) {
+        int res = sendmmsg(fd, msgs + sent, queued - sent, MSG_DONTWAIT);
+        if (res > 0) {
+            sent += res;
+        } else if (res < 0 && errno == EINTR) {
+            continue;
+        } else if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Never wait for the socket, drop the rest
+            dropped += queued - sent;
+            break;
+        } else {
+            // Collector unreachable and such, skip this one
+            dropped++;
+            sent++;
+        }
+    }
+    queued = 0;
+}
@@ -0,0 +1,119 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(IPFIXDUMPER)
+#define IPFIXDUMPER
+
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include "../bwstats.h"
+
+using namespace std;
+
+// Datagram size (fits the usual path MTU) and datagrams sent per batch
+const unsigned int IPFIX_MTU = 1400;
+const unsigned int IPFIX_BATCH = 32;
+
+// Template IDs: host records of internal and external traffic, and flow
+// records, IPv4 and IPv6 each
+const uint16_t IPFIX_HOST_INT4 = 256;
+const uint16_t IPFIX_HOST_INT6 = 257;
+const uint16_t IPFIX_HOST_EXT4 = 258;
+const uint16_t IPFIX_HOST_EXT6 = 259;
+const uint16_t IPFIX_FLOW4 = 260;
+const uint16_t IPFIX_FLOW6 = 261;
+
+/* IPFIX (RFC 7011) exporter over UDP
+ *
+ * Host records (top-K ones too) carry the host address as
+ * sourceIPv4Address or sourceIPv6Address, the dump period as
+ * flowStartSeconds and flowEndSeconds, the bytes sent as octetDeltaCount,
+ * the bytes received as its RFC 5103 reverse element and all the packets
+ * as packetDeltaCount. Each host gets a record of its internal and one of
+ * its external traffic, told apart by the template. Flow records carry
+ * the 5-tuple, first and last seen seconds and their counters.
+ *
+ * Records are encoded in place into a ring of preallocated datagrams,
+ * sent with a single non-blocking sendmmsg() when it fills up and at the
+ * end of the dump: datagrams the socket can't take are dropped (and show
+ * up as sequence gaps in the collector). Templates are sent in the first
+ * dump and again every templateRefresh seconds.
+ */
+class IPFIXBWStatsDumper : public IBWStatsDumper {
+  public:
+    // Collector host:port ([addr]:port for IPv6)
+    IPFIXBWStatsDumper(const char *address, unsigned int templateRefresh);
+    ~IPFIXBWStatsDumper();
+
+    // returns false if the collector address is wrong
+    bool open();
+
+    void beginDump(time_t timestamp);
+    void dumpHost(HostStats *host);
+    void dumpRates(HostStats *host, const struct rate_summary *rates) {};
+    void dumpFlow(FlowStats *flow);
+    void dumpTopHost(HostStats *host, unsigned long long error);
+    void dumpOther(HostStats *other, unsigned long long evicted,
+                   unsigned long long threshold) {};
+    void dumpSubnet(HostStats *subnet, int len) {};
+    void dumpVLAN(HostStats *vlan, unsigned int id) {};
+    void dumpMetrics(const struct metrics_snapshot *metrics) {};
+    void endDump();
+
+  private:
+    string address;
+    unsigned int templateRefresh;
+    int fd;
+
+    // Datagrams ring, the first queued ones are complete
+    u_char *buffers;
+    struct mmsghdr msgs[IPFIX_BATCH];
+    struct iovec iovs[IPFIX_BATCH];
+    unsigned int queued;
+
+    // Message being filled (NULL if none), bytes used and data records
+    u_char *msg;
+    unsigned int used;
+    unsigned int records;
+
+    // Open set of the message and its ID (0 if none)
+    u_char *set;
+    uint16_t setId;
+
+    // Data records exported, dump and templates time, datagrams dropped
+    uint32_t sequence;
+    time_t timestamp;
+    time_t periodStart;
+    time_t templatesTime;
+    unsigned long long dropped;
+
+    // returns room for a record of len bytes in a set of the given ID
+    u_char* reserve(uint16_t id, unsigned int len);
+
+    void startMessage();
+    void finishMessage();
+    void closeSet();
+
+    // Send the complete datagrams
+    void flush();
+
+    // Send the templates in a message of their own
+    void sendTemplates();
+};
+
+#endif
@@ -0,0 +1,212 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "json.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace std;
+
+JSONBWStatsDumper::JSONBWStatsDumper(const char *path) {
+    this->path = path;
+    timestamp = 0;
+}
+
+JSONBWStatsDumper::~JSONBWStatsDumper() {
+    out.flush();
+    if (path != NULL && out.getFd() >= 0) close(out.getFd());
+}
+
+bool JSONBWStatsDumper::open() {
+    if (path == NULL) {
+        out.setFd(STDOUT_FILENO);
+        return true;
+    }
+
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        cerr << "Error opening " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    out.setFd(fd);
+    return true;
+}
+
+void JSONBWStatsDumper::beginDump(time_t timestamp) {
+    this->timestamp = timestamp;
+}
+
+void JSONBWStatsDumper::endDump() {
+    out.flush();
+}
+
+void JSONBWStatsDumper::dumpHost(HostStats *host) {
+    begin("host");
+    address("ip", host->getIP());
+    counters(host);
+    out.put("}\n");
+}
+
+void JSONBWStatsDumper::dumpTopHost(HostStats *host, unsigned long long error) {
+    begin("host");
+    address("ip", host->getIP());
+    counters(host);
+    number("error", error);
+    out.put("}\n");
+}
+
+void JSONBWStatsDumper::dumpOther(HostStats *other, unsigned long long evicted,
+                                  unsigned long long threshold) {
+    begin("other");
+    counters(other);
+    number("evicted", evicted);
+    number("threshold", threshold);
+    out.put("}\n");
+}
+
+void JSONBWStatsDumper::dumpSubnet(HostStats *subnet, int len) {
+    begin("subnet");
+    address("net", subnet->getIP());
+    number("len", len);
+    counters(subnet);
+    out.put("}\n");
+}
+
+void JSONBWStatsDumper::dumpVLAN(HostStats *vlan, unsigned int id) {
+    begin("vlan");
+    number("id", id);
+    counters(vlan);
+    out.put("}\n");
+}
+
+void JSONBWStatsDumper::dumpMetrics(const struct metrics_snapshot *metrics) {
+    for (unsigned int i = 0; i < metrics->captures.size(); i++) {
+        const struct capture_summary *c = &metrics->captures[i];
+        begin("capture");
+        number("id", i);
+        number("packets", c->counters.packets);
+        number("non_ip", c->counters.nonIP);
+        number("truncated", c->counters.truncated);
+        number("kernel_recv", c->counters.kernelRecv);
+        number("kernel_drops", c->counters.kernelDrops);
+        number("if_drops", c->counters.ifDrops);
+        number("pps", c->pps);
+        number("decode_cycles", c->decodeCycles);
+        number("host_cycles", c->hostCycles);
+        number("flow_cycles", c->flowCycles);
+        number("flows", c->counters.flows);
+        number("flow_capacity", c->counters.flowCapacity);
+        out.put("}\n");
+    }
+
+    begin("metrics");
+    number("hosts", metrics->hosts);
+    number("host_capacity", metrics->hostCapacity);
+    number("last_dump_us", metrics->lastDump);
+    out.put(",\"dump_latency\":[");
+    for (unsigned int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        if (i > 0) out.put(',');
+        out.putNumber(metrics->dumpLatency[i]);
+    }
+    out.put("]}\n");
+}
+
+void JSONBWStatsDumper::dumpRates(HostStats *host, const struct rate_summary *rates) {
+    begin("rates");
+    address("ip", host->getIP());
+    number("peak", rates->peak);
+    number("avg", rates->avg);
+    number("p95", rates->p95);
+    out.put("}\n");
+}
+
+void JSONBWStatsDumper::dumpFlow(FlowStats *flow) {
+    const struct flow_key *key = flow->getKey();
+
+    begin("flow");
+    address("src", &key->src);
+    address("dst", &key->dst);
+    number("proto", key->proto);
+    number("sport", key->sport);
+    number("dport", key->dport);
+    number("start", flow->getFirst());
+    number("end", flow->getLast());
+    number("packets", flow->getPackets());
+    number("bytes", flow->getBytes());
+    out.put("}\n");
+}
+
+void JSONBWStatsDumper::begin(const char *type) {
+    out.put("{\"type\":\"");
+    out.put(type);
+    out.put("\",\"ts\":");
+    out.putNumber(timestamp);
+}
+
+void JSONBWStatsDumper::counters(HostStats *host) {
+    BWSummary *sums[2] = { host->getInternalBW(), host->getExternalBW() };
+    const char *names[2] = { ",\"int\":{", ",\"ext\":{" };
+
+    for (int i = 0; i < 2; i++) {
+        out.put(names[i]);
+        out.put("\"sent\":");
+        out.putNumber(sums[i]->totalSent);
+        out.put(",\"recv\":");
+        out.putNumber(sums[i]->totalRecv);
+        out.put(",\"packets\":");
+        out.putNumber(sums[i]->numPackets);
+        out.put(",\"tcp\":");
+        out.putNumber(sums[i]->TCP);
+        out.put(",\"udp\":");
+        out.putNumber(sums[i]->UDP);
+        out.put(",\"icmp\":");
+        out.putNumber(sums[i]->ICMP);
+        if (sums[i]->packetsVar > 0) {
+            out.put(",\"bytes_ci\":");
+            out.putNumber(sums[i]->bytesCI());
+            out.put(",\"packets_ci\":");
+            out.putNumber(sums[i]->packetsCI());
+        }
+        out.put('}');
+    }
+    if (!host->getPeers()->isEmpty()) {
+        number("peers", host->getPeers()->estimate());
+        number("ports", host->getPorts()->estimate());
+    }
+}
+
+void JSONBWStatsDumper::address(const char *name, const struct in6_addr *addr) {
+    char ip[INET6_ADDRSTRLEN];
+    formatIP(addr, ip);
+
+    out.put(",\"");
+    out.put(name);
+    out.put("\":\"");
+    out.put(ip);
+    out.put('"');
+}
+
+void JSONBWStatsDumper::number(const char *name, unsigned long long value) {
+    out.put(",\"");
+    out.put(name);
+    out.put("\":");
+    out.putNumber(value);
+}
@@ -0,0 +1,79 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(JSONDUMPER)
+#define JSONDUMPER
+
+#include "../bwstats.h"
+#include "output.h"
+
+/* JSON lines dumper, one object per host or flow:
+ *
+ * {"type":"host","ts":T,"ip":"10.0.0.1","int":{...},"ext":{...}}
+ * {"type":"flow","ts":T,"src":"...","dst":"...","proto":6,...}
+ *
+ * Host rates (bits per second) follow their host in a "rates" object
+ * with "peak", "avg" and "p95" members. Top-K hosts carry an "error"
+ * member, and the evicted ones are summed in a "other" object with
+ * "evicted" and "threshold" members. Subnet rollups are "subnet" objects
+ * with "net" and "len" members, and VLAN ones "vlan" objects with an "id".
+ * Metrics come last, a "capture" object per capture thread and a
+ * "metrics" one. With random sampling, "int" and "ext" carry the 95%
+ * confidence intervals of the estimates, "bytes_ci" and "packets_ci".
+ * Distinct external peers and ports estimates are "peers" and "ports"
+ * members.
+ */
+class JSONBWStatsDumper : public IBWStatsDumper {
+  public:
+    // Append to the given file (stdout if NULL)
+    JSONBWStatsDumper(const char *path);
+    ~JSONBWStatsDumper();
+
+    // returns false if the file could not be opened
+    bool open();
+
+    void beginDump(time_t timestamp);
+    void dumpHost(HostStats *host);
+    void dumpRates(HostStats *host, const struct rate_summary *rates);
+    void dumpFlow(FlowStats *flow);
+    void dumpTopHost(HostStats *host, unsigned long long error);
+    void dumpOther(HostStats *other, unsigned long long evicted,
+                   unsigned long long threshold);
+    void dumpSubnet(HostStats *subnet, int len);
+    void dumpVLAN(HostStats *vlan, unsigned int id);
+    void dumpMetrics(const struct metrics_snapshot *metrics);
+    void endDump();
+
+  private:
+    const char *path;
+    OutputBuffer out;
+    time_t timestamp;
+
+    // {"type":"<type>","ts":T
+    void begin(const char *type);
+
+    // ,"int":{...},"ext":{...}
+    void counters(HostStats *host);
+
+    // ,"<name>":"<ip>"
+    void address(const char *name, const struct in6_addr *addr);
+
+    // ,"<name>":<value>
+    void number(const char *name, unsigned long long value);
+};
+
+#endif
@@ -0,0 +1,439 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "openmetrics.h"
+#include "output.h"
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <iostream>
+
+using namespace std;
+
+// Max size of a scrape request, seconds to wait for a slow client
+const int HTTP_REQUEST_SIZE = 4096;
+const int HTTP_TIMEOUT = 5;
+
+const char *OPENMETRICS_CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+OpenMetricsBWStatsDumper::OpenMetricsBWStatsDumper() {
+    fd = -1;
+    withMetrics = false;
+    published = "# EOF\n";
+    pthread_mutex_init(&lock, NULL);
+}
+
+OpenMetricsBWStatsDumper::~OpenMetricsBWStatsDumper() {
+    if (fd >= 0) {
+        close(fd);
+        if (address[0] == '/') unlink(address.c_str());
+    }
+    pthread_mutex_destroy(&lock);
+}
+
+bool OpenMetricsBWStatsDumper::open(const char *address) {
+    this->address = address;
+
+    if (address[0] == '/') {
+        struct sockaddr_un sun;
+        if (strlen(address) >= sizeof(sun.sun_path)) {
+            cerr << "Socket path too long: " << address << endl;
+            return false;
+        }
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(address);
+        if (fd < 0 || bind(fd, (struct sockaddr*) &sun, sizeof(sun)) != 0 || listen(fd, 16) != 0) {
+            cerr << "Error listening on " << address << ": " << strerror(errno) << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // host:port, IPv6 hosts in brackets
+    string host = address;
+    string port;
+    size_t colon = host.rfind(':');
+    if (colon == string::npos) {
+        cerr << "Port missing in " << address << endl;
+        return false;
+    }
+    port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+    if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res);
+    if (err != 0) {
+        cerr << "Cannot resolve " << address << ": " << gai_strerror(err) << endl;
+        return false;
+    }
+
+    int one = 1;
+    fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+        cerr << "Error listening on " << address << ": " << strerror(errno) << endl;
+        freeaddrinfo(res);
+        return false;
+    }
+    freeaddrinfo(res);
+    return true;
+}
+
+bool OpenMetricsBWStatsDumper::start() {
+    if (pthread_create(&thread, NULL, thread_main, this) != 0) {
+        cerr << "Cannot create OpenMetrics thread" << endl;
+        return false;
+    }
+    return true;
+}
+
+void OpenMetricsBWStatsDumper::newPeriod() {
+    for (unsigned int i = 0; i < current.capacity(); i++) {
+        HostStats *host = current.at(i);
+        if (host) totals.get(host->getIP())->merge(host);
+    }
+    current.clear();
+}
+
+void OpenMetricsBWStatsDumper::addEvicted(HostStats *host) {
+    totals.get(host->getIP())->merge(host);
+}
+
+void OpenMetricsBWStatsDumper::beginDump(time_t timestamp) {
+    // Every update carries the whole current period
+    current.clear();
+    withMetrics = false;
+}
+
+void OpenMetricsBWStatsDumper::dumpHost(HostStats *host) {
+    *current.get(host->getIP()) = *host;
+}
+
+void OpenMetricsBWStatsDumper::dumpTopHost(HostStats *host, unsigned long long error) {
+    dumpHost(host);
+}
+
+void OpenMetricsBWStatsDumper::dumpMetrics(const struct metrics_snapshot *metrics) {
+    this->metrics = *metrics;
+    withMetrics = true;
+}
+
+static unsigned long long sentBytes(const BWSummary *sum) { return sum->totalSent; }
+static unsigned long long recvBytes(const BWSummary *sum) { return sum->totalRecv; }
+static unsigned long long packets(const BWSummary *sum) { return sum->numPackets; }
+
+void OpenMetricsBWStatsDumper::endDump() {
+    // Previous periods plus the current one
+    hosts.clear();
+    for (unsigned int i = 0; i < totals.capacity(); i++) {
+        HostStats *host = totals.at(i);
+        if (!host) continue;
+        hosts.push_back(*host);
+        HostStats *cur = current.find(host->getIP());
+        if (cur) hosts.back().merge(cur);
+    }
+    for (unsigned int i = 0; i < current.capacity(); i++) {
+        HostStats *host = current.at(i);
+        if (host && !totals.find(host->getIP())) hosts.push_back(*host);
+    }
+
+    text.clear();
+    hostFamily("zbwmonitor_host_sent_bytes", "Bytes sent by the internal host", sentBytes);
+    hostFamily("zbwmonitor_host_received_bytes", "Bytes received by the internal host", recvBytes);
+    hostFamily("zbwmonitor_host_packets", "Packets sent or received by the internal host", packets);
+    protocolFamily();
+    cardinalityFamilies();
+    if (withMetrics) metricsFamilies();
+    text += "# EOF\n";
+
+    pthread_mutex_lock(&lock);
+    published.swap(text);
+    pthread_mutex_unlock(&lock);
+}
+
+void OpenMetricsBWStatsDumper::family(const char *name, const char *type,
+                                      const char *unit, const char *help) {
+    text += "# TYPE "; text += name; text += ' '; text += type; text += '\n';
+    if (unit) {
+        text += "# UNIT "; text += name; text += ' '; text += unit; text += '\n';
+    }
+    text += "# HELP "; text += name; text += ' '; text += help; text += '\n';
+}
+
+void OpenMetricsBWStatsDumper::hostFamily(const char *name, const char *help, counter_fn value) {
+    char ip[INET6_ADDRSTRLEN];
+    string total = string(name) + "_total";
+
+    family(name, "counter", strstr(name, "_bytes") ? "bytes" : NULL, help);
+    for (unsigned int i = 0; i < hosts.size(); i++) {
+        formatIP(hosts[i].getIP(), ip);
+        hostSample(total.c_str(), ip, "internal", NULL, value(hosts[i].getInternalBW()));
+        hostSample(total.c_str(), ip, "external", NULL, value(hosts[i].getExternalBW()));
+    }
+}
+
+void OpenMetricsBWStatsDumper::protocolFamily() {
+    const char *name = "zbwmonitor_host_protocol_bytes_total";
+    char ip[INET6_ADDRSTRLEN];
+
+    family("zbwmonitor_host_protocol_bytes", "counter", "bytes",
+           "Bytes of the internal host traffic by protocol");
+    for (unsigned int i = 0; i < hosts.size(); i++) {
+        BWSummary *sums[2] = { hosts[i].getInternalBW(), hosts[i].getExternalBW() };
+        const char *traffic[2] = { "internal", "external" };
+
+        formatIP(hosts[i].getIP(), ip);
+        for (int j = 0; j < 2; j++) {
+            hostSample(name, ip, traffic[j], "tcp", sums[j]->TCP);
+            hostSample(name, ip, traffic[j], "udp", sums[j]->UDP);
+            hostSample(name, ip, traffic[j], "icmp", sums[j]->ICMP);
+        }
+    }
+}
+
+void OpenMetricsBWStatsDumper::cardinalityFamilies() {
+    char ip[INET6_ADDRSTRLEN];
+    bool counted = false;
+    for (unsigned int i = 0; i < hosts.size() && !counted; i++) {
+        counted = !hosts[i].getPeers()->isEmpty();
+    }
+    if (!counted) return;
+
+    family("zbwmonitor_host_peers", "gauge", NULL,
+           "Distinct external peers of the internal host (estimate)");
+    for (unsigned int i = 0; i < hosts.size(); i++) {
+        if (hosts[i].getPeers()->isEmpty()) continue;
+        formatIP(hosts[i].getIP(), ip);
+        text += "zbwmonitor_host_peers{host=\""; text += ip; text += "\"} ";
+        putNumber(hosts[i].getPeers()->estimate());
+        text += '\n';
+    }
+    family("zbwmonitor_host_ports", "gauge", NULL,
+           "Distinct protocol and port pairs of the external peers of the internal host (estimate)");
+    for (unsigned int i = 0; i < hosts.size(); i++) {
+        if (hosts[i].getPorts()->isEmpty()) continue;
+        formatIP(hosts[i].getIP(), ip);
+        text += "zbwmonitor_host_ports{host=\""; text += ip; text += "\"} ";
+        putNumber(hosts[i].getPorts()->estimate());
+        text += '\n';
+    }
+}
+
+void OpenMetricsBWStatsDumper::metricsFamilies() {
+    const vector<struct capture_summary> &captures = metrics.captures;
+    unsigned int n = captures.size();
+    char value[32];
+
+    family("zbwmonitor_capture_packets", "counter", NULL, "Frames handed over by the capture");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_packets_total", i, NULL, captures[i].counters.packets);
+    }
+    family("zbwmonitor_capture_non_ip_packets", "counter", NULL,
+           "Frames not IP or in an unknown encapsulation");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_non_ip_packets_total", i, NULL, captures[i].counters.nonIP);
+    }
+    family("zbwmonitor_capture_truncated_packets", "counter", NULL,
+           "Frames with the IP header not fully captured");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_truncated_packets_total", i, NULL, captures[i].counters.truncated);
+    }
+    family("zbwmonitor_capture_kernel_received_packets", "counter", NULL,
+           "Packets received by the kernel");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_kernel_received_packets_total", i, NULL, captures[i].counters.kernelRecv);
+    }
+    family("zbwmonitor_capture_kernel_dropped_packets", "counter", NULL,
+           "Packets dropped by the kernel for lack of buffer room");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_kernel_dropped_packets_total", i, NULL, captures[i].counters.kernelDrops);
+    }
+    family("zbwmonitor_capture_interface_dropped_packets", "counter", NULL,
+           "Packets dropped by the interface");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_interface_dropped_packets_total", i, NULL, captures[i].counters.ifDrops);
+    }
+    family("zbwmonitor_capture_packets_per_second", "gauge", NULL, "Packet rate over the last tick");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_packets_per_second", i, NULL, captures[i].pps);
+    }
+    family("zbwmonitor_capture_cycles_per_packet", "gauge", NULL,
+           "Per packet cost of each stage over the last tick");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_cycles_per_packet", i, "decode", captures[i].decodeCycles);
+        captureSample("zbwmonitor_capture_cycles_per_packet", i, "host", captures[i].hostCycles);
+        captureSample("zbwmonitor_capture_cycles_per_packet", i, "flow", captures[i].flowCycles);
+    }
+    family("zbwmonitor_capture_flows", "gauge", NULL, "Flows tracked by the capture thread");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_flows", i, NULL, captures[i].counters.flows);
+    }
+    family("zbwmonitor_capture_flow_capacity", "gauge", NULL, "Room for flows of the capture thread");
+    for (unsigned int i = 0; i < n; i++) {
+        captureSample("zbwmonitor_capture_flow_capacity", i, NULL, captures[i].counters.flowCapacity);
+    }
+
+    family("zbwmonitor_hosts", "gauge", NULL, "Hosts kept in the stats");
+    text += "zbwmonitor_hosts "; putNumber(metrics.hosts); text += '\n';
+    family("zbwmonitor_hosts_capacity", "gauge", NULL, "Room for hosts in the stats");
+    text += "zbwmonitor_hosts_capacity "; putNumber(metrics.hostCapacity); text += '\n';
+
+    // Bucket i counts the dumps under 2^i ms, the last one is +Inf
+    unsigned long long count = 0;
+    family("zbwmonitor_dump_seconds", "histogram", "seconds", "Time spent dumping the stats");
+    for (unsigned int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        count += metrics.dumpLatency[i];
+        if (i < METRICS_LATENCY_BUCKETS - 1) {
+            snprintf(value, sizeof(value), "%.3f", (1 << i) / 1000.0);
+        } else {
+            strcpy(value, "+Inf");
+        }
+        text += "zbwmonitor_dump_seconds_bucket{le=\""; text += value; text += "\"} ";
+        putNumber(count);
+        text += '\n';
+    }
+    text += "zbwmonitor_dump_seconds_count "; putNumber(count); text += '\n';
+    snprintf(value, sizeof(value), "%.6f", metrics.dumpTime / 1e6);
+    text += "zbwmonitor_dump_seconds_sum "; text += value; text += '\n';
+}
+
+void OpenMetricsBWStatsDumper::hostSample(const char *name, const char *ip, const char *traffic,
+                                          const char *protocol, unsigned long long value) {
+    text += name;
+    text += "{host=\""; text += ip;
+    text += "\",traffic=\""; text += traffic;
+    if (protocol) {
+        text += "\",protocol=\""; text += protocol;
+    }
+    text += "\"} ";
+    putNumber(value);
+    text += '\n';
+}
+
+void OpenMetricsBWStatsDumper::captureSample(const char *name, unsigned int id, const char *stage,
+                                             unsigned long long value) {
+    text += name;
+    text += "{capture=\""; putNumber(id);
+    if (stage) {
+        text += "\",stage=\""; text += stage;
+    }
+    text += "\"} ";
+    putNumber(value);
+    text += '\n';
+}
+
+void OpenMetricsBWStatsDumper::putNumber(unsigned long long n) {
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    text.append(p, buf + sizeof(buf) - p);
+}
+
+void *OpenMetricsBWStatsDumper::thread_main(void *dumper) {
+    ((OpenMetricsBWStatsDumper*) dumper)->serve();
+    return NULL;
+}
+
+void OpenMetricsBWStatsDumper::serve() {
+    struct timeval timeout = { HTTP_TIMEOUT, 0 };
+
+    for (;;) {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno != EINTR) cerr << "OpenMetrics accept: " << strerror(errno) << endl;
+            continue;
+        }
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        answer(client);
+        close(client);
+    }
+}
+
+// Send all of data, returns false on error
+static bool sendAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t res = send(fd, data, len, MSG_NOSIGNAL);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return false;
+        data += res;
+        len -= res;
+    }
+    return true;
+}
+
+void OpenMetricsBWStatsDumper::answer(int client) {
+    char request[HTTP_REQUEST_SIZE + 1];
+    size_t len = 0;
+
+    // Only the request line matters, read up to the end of the headers
+    while (len < HTTP_REQUEST_SIZE) {
+        ssize_t res = recv(client, request + len, HTTP_REQUEST_SIZE - len, 0);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return;
+        len += res;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+    }
+    request[len] = '\0';
+
+    bool head = strncmp(request, "HEAD ", 5) == 0;
+    const char *path = head ? request + 5 : request + 4;
+    if (!head && strncmp(request, "GET ", 4) != 0) {
+        const char *res = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET, HEAD\r\n"
+                          "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        sendAll(client, res, strlen(res));
+        return;
+    }
+    if (strncmp(path, "/metrics ", 9) != 0 && strncmp(path, "/ ", 2) != 0) {
+        const char *res = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n"
+                          "Connection: close\r\n\r\n";
+        sendAll(client, res, strlen(res));
+        return;
+    }
+
+    // Copy the exposition, the collector may publish a new one meanwhile
+    pthread_mutex_lock(&lock);
+    string body = published;
+    pthread_mutex_unlock(&lock);
+
+    char header[256];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %lu\r\n"
+                     "Connection: close\r\n\r\n",
+                     OPENMETRICS_CONTENT_TYPE, (unsigned long) body.size());
+    if (!sendAll(client, header, n) || head) return;
+    sendAll(client, body.data(), body.size());
+}
@@ -0,0 +1,128 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(OPENMETRICSDUMPER)
+#define OPENMETRICSDUMPER
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "../bwstats.h"
+#include "../hosttable.h"
+
+using namespace std;
+
+/* OpenMetrics (Prometheus) exposition over HTTP
+ *
+ * Fed by the collector after every tick, like the live stats. Host
+ * counters are added to the ones of the previous dump periods, so they
+ * only go up while the daemon runs:
+ *
+ *   zbwmonitor_host_sent_bytes_total{host="10.0.0.1",traffic="internal"} 1234
+ *
+ * Distinct peers and ports estimates of the hosts are gauges, over the
+ * whole run too.
+ *
+ * The whole exposition is rendered in the collector thread and kept as
+ * text, a scrape only copies it. Scrapes never wait for the stats nor
+ * the capture threads.
+ */
+class OpenMetricsBWStatsDumper : public IBWStatsDumper {
+  public:
+    OpenMetricsBWStatsDumper();
+    ~OpenMetricsBWStatsDumper();
+
+    // Listen on address: "host:port", "[ipv6]:port" or a unix socket
+    // path (starting with /). returns false on error
+    bool open(const char *address);
+
+    // Start serving scrapes in a background thread
+    bool start();
+
+    // Counters of the last update are added to the totals
+    void newPeriod();
+
+    // Add the counters of a host leaving the stats before the period end
+    // to the totals (the following updates don't carry them)
+    void addEvicted(HostStats *host);
+
+    void beginDump(time_t timestamp);
+    void dumpHost(HostStats *host);
+    void dumpRates(HostStats *host, const struct rate_summary *rates) {};
+    void dumpFlow(FlowStats *flow) {};
+    void dumpTopHost(HostStats *host, unsigned long long error);
+    void dumpOther(HostStats *other, unsigned long long evicted,
+                   unsigned long long threshold) {};
+    void dumpSubnet(HostStats *subnet, int len) {};
+    void dumpVLAN(HostStats *vlan, unsigned int id) {};
+    void dumpMetrics(const struct metrics_snapshot *metrics);
+    void endDump();
+
+  private:
+    string address;
+    int fd;
+    pthread_t thread;
+
+    // Previous dump periods totals and current period counters
+    HostTable totals;
+    HostTable current;
+
+    // Both added up, the hosts rendered by the running update
+    vector<HostStats> hosts;
+
+    // Metrics of the running update (if any)
+    struct metrics_snapshot metrics;
+    bool withMetrics;
+
+    // Exposition being rendered and the published one (under lock)
+    string text;
+    string published;
+    pthread_mutex_t lock;
+
+    // Render a host counter family, value picks the counter
+    typedef unsigned long long (*counter_fn)(const BWSummary *sum);
+    void hostFamily(const char *name, const char *help, counter_fn value);
+
+    // Render the protocol bytes family
+    void protocolFamily();
+
+    // Render the distinct peers and ports families (if counted)
+    void cardinalityFamilies();
+
+    // Render the self instrumentation families
+    void metricsFamilies();
+
+    // # TYPE, # UNIT and # HELP lines of a family
+    void family(const char *name, const char *type, const char *unit, const char *help);
+
+    // <name>{host="<ip>",traffic="<traffic>"[,protocol="<protocol>"]} <value>
+    void hostSample(const char *name, const char *ip, const char *traffic,
+                    const char *protocol, unsigned long long value);
+
+    // <name>{capture="<id>"[,stage="<stage>"]} <value>
+    void captureSample(const char *name, unsigned int id, const char *stage,
+                       unsigned long long value);
+
+    void putNumber(unsigned long long n);
+
+    // Answer the scrapes
+    void serve();
+    void answer(int client);
+    static void *thread_main(void *dumper);
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "output.h"
+#include "../packet.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace std;
+
+OutputBuffer::OutputBuffer() {
+    buf = new char[OUTPUT_BUFFER_SIZE];
+    used = 0;
+    fd = -1;
+    failed = false;
+}
+
+OutputBuffer::~OutputBuffer() {
+    delete[] buf;
+}
+
+void OutputBuffer::write(const void *data, size_t len) {
+    const char *p = (const char*) data;
+    while (len > 0) {
+        if (used == OUTPUT_BUFFER_SIZE) flush();
+        size_t n = OUTPUT_BUFFER_SIZE - used;
+        if (n > len) n = len;
+        memcpy(buf + used, p, n);
+        used += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void OutputBuffer::put(const char *str) {
+    write(str, strlen(str));
+}
+
+void OutputBuffer::putNumber(unsigned long long n) {
+    char digits[20];
+    int i = 0;
+    do {
+        digits[i++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+
+    if (used + i > OUTPUT_BUFFER_SIZE) flush();
+    while (i > 0) buf[used++] = digits[--i];
+}
+
+bool OutputBuffer::flush() {
+    size_t done = 0;
+    while (done < used) {
+        ssize_t res = ::write(fd, buf + done, used - done);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+
+            // Data is lost, report it once
+            if (!failed) cerr << "Error writing stats: " << strerror(errno) << endl;
+            failed = true;
+            used = 0;
+            return false;
+        }
+        done += res;
+    }
+    used = 0;
+    failed = false;
+    return true;
+}
+
+void formatIP(const struct in6_addr *addr, char *ip) {
+    if (isMappedIPv4(addr)) {
+        inet_ntop(AF_INET, addr->s6_addr + 12, ip, INET6_ADDRSTRLEN);
+    } else {
+        inet_ntop(AF_INET6, addr, ip, INET6_ADDRSTRLEN);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(OUTPUT)
+#define OUTPUT
+
+#include <netinet/in.h>
+#include <stddef.h>
+
+// Size of the dumpers write buffer
+const size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+/* Write buffer for the dumpers
+ *
+ * Everything is copied to one large buffer and only written to the file
+ * descriptor when it fills up or on flush(), so a dump takes a handful
+ * of write calls.
+ */
+class OutputBuffer {
+  public:
+    OutputBuffer();
+    ~OutputBuffer();
+
+    // Set the destination, it's not closed by the buffer
+    void setFd(int fd) { this->fd = fd; }
+    int getFd() { return fd; }
+
+    void write(const void *data, size_t len);
+    void put(const char *str);
+    void put(char c) {
+        if (used == OUTPUT_BUFFER_SIZE) flush();
+        buf[used++] = c;
+    }
+
+    // Decimal representation of n
+    void putNumber(unsigned long long n);
+
+    // Write all the buffered data, returns false on error
+    bool flush();
+
+  private:
+    char *buf;
+    size_t used;
+    int fd;
+    bool failed;
+
+    // Not copyable
+    OutputBuffer(const OutputBuffer&);
+    OutputBuffer& operator=(const OutputBuffer&);
+};
+
+// Text form of an address, IPv4-mapped ones as plain IPv4. ip must have
+// room for INET6_ADDRSTRLEN chars
+void formatIP(const struct in6_addr *addr, char *ip);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "shm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <iostream>
+
+using namespace std;
+
+SharedMemBWStatsDumper::SharedMemBWStatsDumper(const char *name, unsigned int capacity) {
+    this->name = name;
+    this->capacity = capacity;
+    size = sizeof(struct live_header) + capacity * sizeof(struct live_host);
+    header = NULL;
+    hosts = NULL;
+    count = 0;
+    dropped = 0;
+    periodEnded = true;
+}
+
+SharedMemBWStatsDumper::~SharedMemBWStatsDumper() {
+    if (header != NULL) {
+        munmap(header, size);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool SharedMemBWStatsDumper::open() {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Error creating shared memory " << name << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        cerr << "Error sizing shared memory " << name << ": " << strerror(errno) << endl;
+        close(fd);
+        return false;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        cerr << "Error mapping shared memory " << name << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    header = (struct live_header*) mem;
+    hosts = (struct live_host*) (header + 1);
+    memcpy(header->magic, LIVE_MAGIC, sizeof(header->magic));
+    header->version = LIVE_VERSION;
+    header->recordSize = sizeof(struct live_host);
+    header->capacity = capacity;
+    return true;
+}
+
+void SharedMemBWStatsDumper::beginDump(time_t timestamp) {
+    if (header == NULL) return;
+
+    // Readers retry while seq is odd
+    header->seq++;
+    __sync_synchronize();
+
+    header->timestamp = timestamp;
+    if (periodEnded) {
+        header->periodStart = timestamp;
+        periodEnded = false;
+    }
+    count = 0;
+    dropped = 0;
+}
+
+void SharedMemBWStatsDumper::dumpHost(HostStats *host) {
+    if (header == NULL) return;
+    if (count == capacity) {
+        dropped++;
+        return;
+    }
+
+    BWSummary *sums[2] = { host->getInternalBW(), host->getExternalBW() };
+    struct live_host *rec = &hosts[count++];
+    struct bwdump_summary *recSums[2] = { &rec->internal, &rec->external };
+
+    rec->addr = *host->getIP();
+    for (int i = 0; i < 2; i++) {
+        recSums[i]->sent = sums[i]->totalSent;
+        recSums[i]->recv = sums[i]->totalRecv;
+        recSums[i]->packets = sums[i]->numPackets;
+        recSums[i]->tcp = sums[i]->TCP;
+        recSums[i]->udp = sums[i]->UDP;
+        recSums[i]->icmp = sums[i]->ICMP;
+    }
+}
+
+void SharedMemBWStatsDumper::dumpTopHost(HostStats *host, unsigned long long error) {
+    dumpHost(host);
+}
+
+void SharedMemBWStatsDumper::endDump() {
+    if (header == NULL) return;
+
+    header->hosts = count;
+    header->dropped = dropped;
+
+    __sync_synchronize();
+    header->seq++;
+}
@@ -0,0 +1,107 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(SHMDUMPER)
+#define SHMDUMPER
+
+#include <stdint.h>
+#include <string>
+#include "../bwstats.h"
+#include "binary.h"
+
+using namespace std;
+
+/* Live stats shared memory segment (POSIX shm, /dev/shm/<name>)
+ *
+ * A header followed by header.capacity host records, host byte order.
+ * Counters are the ones of the current dump period, they start again
+ * from zero when periodStart changes.
+ *
+ * The segment is updated in place, readers must follow the seqlock
+ * protocol to get a consistent copy:
+ *
+ *   do {
+ *       s1 = header->seq;          (retry while odd, update running)
+ *       copy header and header->hosts records
+ *       s2 = header->seq;
+ *   } while (s1 != s2 || s1 & 1);
+ */
+
+const char LIVE_MAGIC[4] = { 'Z', 'B', 'W', 'L' };
+const uint32_t LIVE_VERSION = 1;
+
+struct live_header {
+    char magic[4];
+    uint32_t version;
+    volatile uint32_t seq;      // odd while being updated
+    uint32_t recordSize;        // sizeof(struct live_host)
+    uint32_t capacity;          // records room
+    uint32_t hosts;             // records in use
+    uint32_t dropped;           // hosts left out (no room)
+    uint32_t reserved;
+    uint64_t timestamp;         // last update
+    uint64_t periodStart;       // first update of the current dump period
+    uint8_t pad[16];
+};
+
+struct live_host {
+    struct in6_addr addr;       // IPv4-mapped for IPv4
+    struct bwdump_summary internal;
+    struct bwdump_summary external;
+};
+
+
+/* Publishes the stats in the live segment */
+class SharedMemBWStatsDumper : public IBWStatsDumper {
+  public:
+    // Segment name (as in shm_open) and max number of hosts
+    SharedMemBWStatsDumper(const char *name, unsigned int capacity);
+    ~SharedMemBWStatsDumper();
+
+    // Create the segment, returns false on error
+    bool open();
+
+    // Next update starts a new dump period
+    void newPeriod() { periodEnded = true; }
+
+    void beginDump(time_t timestamp);
+    void dumpHost(HostStats *host);
+    void dumpRates(HostStats *host, const struct rate_summary *rates) {};
+    void dumpFlow(FlowStats *flow) {};
+    void dumpTopHost(HostStats *host, unsigned long long error);
+    void dumpOther(HostStats *other, unsigned long long evicted,
+                   unsigned long long threshold) {};
+    void dumpSubnet(HostStats *subnet, int len) {};
+    void dumpVLAN(HostStats *vlan, unsigned int id) {};
+    void dumpMetrics(const struct metrics_snapshot *metrics) {};
+    void endDump();
+
+  private:
+    string name;
+    unsigned int capacity;
+    size_t size;
+
+    struct live_header *header;
+    struct live_host *hosts;
+
+    // Records written in the running update
+    unsigned int count;
+    unsigned int dropped;
+    bool periodEnded;
+};
+
+#endif
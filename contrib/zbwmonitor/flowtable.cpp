@@ -0,0 +1,286 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "flowtable.h"
+#include <stdlib.h>
+#include <new>
+
+// Max displacements when both buckets of a new flow are full
+const unsigned int FLOW_MAX_KICKS = 64;
+
+// Seconds to check the whole table for expired flows
+const unsigned int FLOW_SWEEP_TIME = 4;
+
+/* FlowStats */
+
+FlowStats::FlowStats(const struct flow_key *key, uint32_t now) {
+    this->key = *key;
+    first = now;
+    last = now;
+    packets = 0;
+    bytes = 0;
+}
+
+/* FlowTable */
+
+static void *alignedAlloc(size_t size) {
+    void *mem;
+    if (posix_memalign(&mem, 64, size) != 0) throw std::bad_alloc();
+    return mem;
+}
+
+FlowTable::FlowTable(unsigned int capacity, unsigned int idleTimeout, unsigned int activeTimeout) {
+    if (capacity == 0) capacity = 1;
+
+    // Keep buckets at most ~85% full, cuckoo inserts stay short
+    unsigned int nbuckets = 2;
+    while (nbuckets * FLOW_BUCKET_SLOTS * 85 < capacity * 100ULL) nbuckets <<= 1;
+
+    buckets = (bucket*) alignedAlloc(nbuckets * sizeof(bucket));
+    memset(buckets, 0, nbuckets * sizeof(bucket));
+    mask = nbuckets - 1;
+
+    flows = (FlowStats*) alignedAlloc(capacity * sizeof(FlowStats));
+    used = new unsigned char[capacity];
+    memset(used, 0, capacity);
+    freeList = new uint32_t[capacity];
+    for (unsigned int i = 0; i < capacity; i++) {
+        freeList[i] = capacity - 1 - i;
+    }
+    entries = capacity;
+    count = 0;
+
+    this->idleTimeout = idleTimeout;
+    this->activeTimeout = activeTimeout;
+    cursor = 0;
+    lastSweep = 0;
+}
+
+FlowTable::~FlowTable() {
+    free(buckets);
+    free(flows);
+    delete[] used;
+    delete[] freeList;
+}
+
+void FlowTable::addPacket(const struct packet_info *pkt, uint32_t now, IFlowSink *sink) {
+    struct flow_key key;
+    flowKey(pkt, &key);
+    account(pkt, &key, hash(&key), now, sink);
+}
+
+void FlowTable::addBatch(const struct packet_info *pkts, unsigned int count,
+                         uint32_t now, IFlowSink *sink) {
+    struct flow_key keys[PACKET_BATCH_SIZE];
+    uint64_t hashes[PACKET_BATCH_SIZE];
+
+    while (count > 0) {
+        unsigned int n = count < PACKET_BATCH_SIZE ? count : PACKET_BATCH_SIZE;
+
+        // Hash the whole batch and prefetch both buckets of each flow...
+        for (unsigned int i = 0; i < n; i++) {
+            flowKey(&pkts[i], &keys[i]);
+            hashes[i] = hash(&keys[i]);
+            unsigned int b = hashes[i] & mask;
+            __builtin_prefetch(&buckets[b]);
+            __builtin_prefetch(&buckets[altBucket(b, signature(hashes[i]))]);
+        }
+
+        // ...then account them
+        for (unsigned int i = 0; i < n; i++) {
+            account(&pkts[i], &keys[i], hashes[i], now, sink);
+        }
+
+        pkts += n;
+        count -= n;
+    }
+}
+
+void FlowTable::account(const struct packet_info *pkt, const struct flow_key *key,
+                        uint64_t hash, uint32_t now, IFlowSink *sink) {
+    FlowStats *flow = find(key, hash);
+    if (flow == NULL) {
+        insert(pkt, key, hash, now, sink);
+        return;
+    }
+
+    // Long lived flow, report what we have and start again
+    if (now >= flow->first + activeTimeout) {
+        if (flow->packets > 0) sink->addFlow(flow);
+        flow->first = now;
+        flow->packets = 0;
+        flow->bytes = 0;
+    }
+    flow->addPacket(pkt, now);
+}
+
+FlowStats* FlowTable::find(const struct flow_key *key, uint64_t hash) {
+    uint16_t sig = signature(hash);
+    unsigned int b = hash & mask;
+
+    for (int i = 0; i < 2; i++) {
+        bucket *bk = &buckets[b];
+        for (unsigned int s = 0; s < FLOW_BUCKET_SLOTS; s++) {
+            if (bk->sig[s] != sig) continue;
+            FlowStats *flow = &flows[bk->idx[s]];
+            if (memcmp(&flow->key, key, sizeof(struct flow_key)) == 0) return flow;
+        }
+        b = altBucket(b, sig);
+    }
+    return NULL;
+}
+
+void FlowTable::insert(const struct packet_info *pkt, const struct flow_key *key,
+                       uint64_t hash, uint32_t now, IFlowSink *sink) {
+    uint16_t sig = signature(hash);
+    unsigned int b = hash & mask;
+
+    // No free entries, evict the least recently seen flow of both buckets
+    // (or any flow, if they are empty)
+    if (count == entries) {
+        uint32_t victim = cursor;
+        uint32_t oldest = 0xffffffff;
+        unsigned int cb = b;
+        for (int i = 0; i < 2; i++) {
+            for (unsigned int s = 0; s < FLOW_BUCKET_SLOTS; s++) {
+                if (buckets[cb].sig[s] == 0) continue;
+                uint32_t idx = buckets[cb].idx[s];
+                if (flows[idx].last < oldest) {
+                    oldest = flows[idx].last;
+                    victim = idx;
+                }
+            }
+            cb = altBucket(cb, sig);
+        }
+        remove(victim, sink);
+    }
+
+    uint32_t idx = freeList[entries - count - 1];
+    count++;
+    used[idx] = 1;
+    new (&flows[idx]) FlowStats(key, now);
+    flows[idx].addPacket(pkt, now);
+
+    // Buckets too crowded, the flow left out (maybe this one) goes away
+    if (!place(b, sig, idx)) {
+        sink->addFlow(&flows[idx]);
+        release(idx);
+    }
+}
+
+bool FlowTable::place(unsigned int b, uint16_t sig, uint32_t &idx) {
+    unsigned int alt = altBucket(b, sig);
+    for (unsigned int s = 0; s < FLOW_BUCKET_SLOTS; s++) {
+        if (buckets[b].sig[s] == 0) {
+            buckets[b].sig[s] = sig;
+            buckets[b].idx[s] = idx;
+            return true;
+        }
+    }
+    for (unsigned int s = 0; s < FLOW_BUCKET_SLOTS; s++) {
+        if (buckets[alt].sig[s] == 0) {
+            buckets[alt].sig[s] = sig;
+            buckets[alt].idx[s] = idx;
+            return true;
+        }
+    }
+
+    // Both full, kick entries to their alternate bucket until one of
+    // them finds room
+    for (unsigned int kick = 0; kick < FLOW_MAX_KICKS; kick++) {
+        unsigned int s = (sig + kick) % FLOW_BUCKET_SLOTS;
+        uint16_t kickedSig = buckets[b].sig[s];
+        uint32_t kickedIdx = buckets[b].idx[s];
+        buckets[b].sig[s] = sig;
+        buckets[b].idx[s] = idx;
+        sig = kickedSig;
+        idx = kickedIdx;
+
+        b = altBucket(b, sig);
+        for (s = 0; s < FLOW_BUCKET_SLOTS; s++) {
+            if (buckets[b].sig[s] == 0) {
+                buckets[b].sig[s] = sig;
+                buckets[b].idx[s] = idx;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void FlowTable::remove(uint32_t idx, IFlowSink *sink) {
+    FlowStats *flow = &flows[idx];
+    uint64_t h = hash(&flow->key);
+    uint16_t sig = signature(h);
+    unsigned int b = h & mask;
+
+    bool found = false;
+    for (int i = 0; i < 2 && !found; i++) {
+        for (unsigned int s = 0; s < FLOW_BUCKET_SLOTS; s++) {
+            if (buckets[b].sig[s] == sig && buckets[b].idx[s] == idx) {
+                buckets[b].sig[s] = 0;
+                found = true;
+                break;
+            }
+        }
+        b = altBucket(b, sig);
+    }
+
+    if (flow->packets > 0) sink->addFlow(flow);
+    release(idx);
+}
+
+void FlowTable::release(uint32_t idx) {
+    used[idx] = 0;
+    count--;
+    freeList[entries - count - 1] = idx;
+}
+
+void FlowTable::check(uint32_t idx, uint32_t now, IFlowSink *sink) {
+    if (!used[idx]) return;
+
+    FlowStats *flow = &flows[idx];
+    if (now >= flow->last + idleTimeout) {
+        remove(idx, sink);
+    } else if (now >= flow->first + activeTimeout) {
+        if (flow->packets > 0) sink->addFlow(flow);
+        flow->first = now;
+        flow->packets = 0;
+        flow->bytes = 0;
+    }
+}
+
+void FlowTable::expire(uint32_t now, IFlowSink *sink) {
+    if (now <= lastSweep) return;
+
+    // Enough entries to go through the table every FLOW_SWEEP_TIME seconds
+    unsigned long long budget = (entries + FLOW_SWEEP_TIME - 1) / FLOW_SWEEP_TIME;
+    if (lastSweep > 0) budget *= now - lastSweep;
+    if (budget > entries) budget = entries;
+    lastSweep = now;
+
+    for (unsigned int n = 0; n < budget; n++) {
+        check(cursor, now, sink);
+        if (++cursor == entries) cursor = 0;
+    }
+}
+
+void FlowTable::flush(IFlowSink *sink) {
+    for (unsigned int i = 0; i < entries; i++) {
+        if (used[i]) remove(i, sink);
+    }
+}
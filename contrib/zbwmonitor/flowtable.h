@@ -0,0 +1,197 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(FLOWTABLE)
+#define FLOWTABLE
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include "packet.h"
+
+// Entries per bucket, a bucket fills one cache line
+const unsigned int FLOW_BUCKET_SLOTS = 8;
+
+// Flow identifier (unidirectional), padding is always zeroed so keys can
+// be compared and hashed as raw memory
+struct flow_key {
+    struct in6_addr src;
+    struct in6_addr dst;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t pad[3];
+};
+
+/* Counters of a flow (one cache line) */
+class FlowStats {
+  public:
+    FlowStats() {};
+    FlowStats(const struct flow_key *key, uint32_t now);
+
+    // Add a packet seen at the given time
+    void addPacket(const struct packet_info *pkt, uint32_t now) {
+        packets += pkt->weight;
+        bytes += (unsigned long long) pkt->len * pkt->weight;
+        last = now;
+    }
+
+    // Flow addresses, IPv4 ones are IPv4-mapped
+    const struct flow_key* getKey() { return &key; }
+    bool isIPv4() { return isMappedIPv4(&key.src); }
+
+    uint32_t getFirst() { return first; }
+    uint32_t getLast() { return last; }
+    unsigned long long getPackets() { return packets; }
+    unsigned long long getBytes() { return bytes; }
+
+  private:
+    struct flow_key key;
+    uint32_t first;
+    uint32_t last;
+    unsigned long long packets;
+    unsigned long long bytes;
+
+    friend class FlowTable;
+};
+
+// Receives the flows leaving the table (expired or evicted)
+class IFlowSink {
+  public:
+    virtual void addFlow(const FlowStats *flow) = 0;
+};
+
+/* Per capture thread flow table
+ *
+ * Bucketized cuckoo hash: every flow can live in one of two buckets of
+ * FLOW_BUCKET_SLOTS entries, each bucket a cache line holding a 16 bit
+ * signature and the index of the flow counters for every slot. A lookup
+ * reads at most two lines before touching the counters. The alternate
+ * bucket is derived from the signature, so entries can be moved without
+ * rehashing their keys.
+ *
+ * Memory is fixed at creation: when the table is full the least recently
+ * seen flow of the candidate buckets is evicted. Flows also leave after
+ * being idle for idleTimeout seconds, and long lived ones are reported
+ * every activeTimeout seconds (counters restart). Leaving flows are
+ * passed to the sink. Not thread safe, one table per capture thread.
+ */
+class FlowTable {
+  public:
+    FlowTable(unsigned int capacity, unsigned int idleTimeout, unsigned int activeTimeout);
+    ~FlowTable();
+
+    // Account a batch of packets seen at the given time
+    void addBatch(const struct packet_info *pkts, unsigned int count,
+                  uint32_t now, IFlowSink *sink);
+
+    // Account a packet seen at the given time
+    void addPacket(const struct packet_info *pkt, uint32_t now, IFlowSink *sink);
+
+    // Expire idle and active flows, only a part of the table is checked
+    // on each call so a full sweep takes a few seconds
+    void expire(uint32_t now, IFlowSink *sink);
+
+    // Pass all the flows to the sink and empty the table
+    void flush(IFlowSink *sink);
+
+    unsigned int size() { return count; }
+    unsigned int capacity() { return entries; }
+
+    // Hash of a key
+    static uint64_t hash(const struct flow_key *key);
+
+  private:
+    struct bucket {
+        uint16_t sig[FLOW_BUCKET_SLOTS];    // 0 means empty slot
+        uint32_t idx[FLOW_BUCKET_SLOTS];
+    } __attribute__((aligned(64)));
+
+    bucket *buckets;
+    unsigned int mask;
+
+    // Flow counters and free entries
+    FlowStats *flows;
+    unsigned char *used;
+    uint32_t *freeList;
+    unsigned int entries;
+    unsigned int count;
+
+    unsigned int idleTimeout;
+    unsigned int activeTimeout;
+
+    // Expiration sweep position
+    unsigned int cursor;
+    uint32_t lastSweep;
+
+    static uint16_t signature(uint64_t hash) { return (hash >> 48) | 1; }
+    unsigned int altBucket(unsigned int b, uint16_t sig) {
+        return (b ^ ((uint32_t) sig * 0x5bd1e995u)) & mask;
+    }
+
+    // Account a packet to its flow
+    void account(const struct packet_info *pkt, const struct flow_key *key,
+                 uint64_t hash, uint32_t now, IFlowSink *sink);
+
+    // returns the flow for key, NULL if not found
+    FlowStats* find(const struct flow_key *key, uint64_t hash);
+
+    // Insert a new flow with its first packet, evicting one if needed
+    void insert(const struct packet_info *pkt, const struct flow_key *key,
+                uint64_t hash, uint32_t now, IFlowSink *sink);
+
+    // Place an entry in one of its buckets, displacing others if needed.
+    // returns false if an entry was left out (its index in idx)
+    bool place(unsigned int b, uint16_t sig, uint32_t &idx);
+
+    // Remove the flow stored in the given entry, passing it to the sink
+    void remove(uint32_t idx, IFlowSink *sink);
+
+    // Return an entry to the free list
+    void release(uint32_t idx);
+
+    // Check timeouts of one entry
+    void check(uint32_t idx, uint32_t now, IFlowSink *sink);
+
+    // Not copyable
+    FlowTable(const FlowTable&);
+    FlowTable& operator=(const FlowTable&);
+};
+
+// Build the key of a packet
+inline void flowKey(const struct packet_info *pkt, struct flow_key *key) {
+    key->src = pkt->src;
+    key->dst = pkt->dst;
+    key->sport = pkt->sport;
+    key->dport = pkt->dport;
+    key->proto = pkt->proto;
+    memset(key->pad, 0, sizeof(key->pad));
+}
+
+inline uint64_t FlowTable::hash(const struct flow_key *key) {
+    const unsigned char *p = (const unsigned char*) key;
+    uint64_t h = 0;
+    for (unsigned int i = 0; i < sizeof(struct flow_key); i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+#endif
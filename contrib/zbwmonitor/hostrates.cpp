@@ -0,0 +1,219 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "hostrates.h"
+#include "hosttable.h"
+#include <algorithm>
+#include <vector>
+#include <string.h>
+
+using namespace std;
+
+// Largest count a bucket can hold
+const unsigned long long MAX_BUCKET_BYTES = 4095ULL << 30;
+
+// Counts under 2048 are stored as is, bigger ones as an 11 bit mantissa
+// (12 with the implicit leading one) and a 5 bit shift
+static inline uint16_t encodeBytes(unsigned long long n) {
+    if (n < 2048) return n;
+    if (n > MAX_BUCKET_BYTES) n = MAX_BUCKET_BYTES;
+
+    unsigned int e = 64 - __builtin_clzll(n) - 11;
+    return (e << 11) | ((n >> (e - 1)) - 2048);
+}
+
+static inline unsigned long long decodeBytes(uint16_t code) {
+    unsigned int e = code >> 11;
+    if (e == 0) return code;
+    return (2048ULL + (code & 0x7ff)) << (e - 1);
+}
+
+static inline unsigned char indexTag(uint64_t hash) {
+    return 0x80 | (hash >> 57);
+}
+
+HostRates::HostRates(unsigned int buckets, unsigned int width, unsigned int capacity) {
+    this->buckets = buckets > 0 ? buckets : 1;
+    this->width = width > 0 ? width : 1;
+    current = 0;
+
+    this->capacity = 0;
+    count = 0;
+    samples = NULL;
+    pending = NULL;
+    hosts = NULL;
+    tags = NULL;
+    index = NULL;
+    mask = 0;
+
+    while (this->capacity < capacity || this->capacity == 0) grow();
+}
+
+HostRates::~HostRates() {
+    delete[] samples;
+    delete[] pending;
+    delete[] hosts;
+    delete[] tags;
+    delete[] index;
+}
+
+void HostRates::add(const struct in6_addr *ip, unsigned long long bytes) {
+    int entry = find(ip);
+
+    if (entry < 0) {
+        if (count == capacity) grow();
+
+        uint64_t h = HostTable::hash(ip);
+        unsigned int i = (h >> 32) & mask;
+        while (tags[i] != 0) i = (i + 1) & mask;
+        tags[i] = indexTag(h);
+        index[i] = count;
+        hosts[count] = *ip;
+
+        memset(&samples[(size_t) count * buckets], 0, buckets * sizeof(uint16_t));
+        pending[count] = 0;
+        entry = count++;
+    }
+
+    pending[entry] += bytes;
+}
+
+void HostRates::tick() {
+    // The last bucket keeps adding up if the period runs longer
+    for (unsigned int r = 0; r < count; r++) {
+        if (pending[r] == 0) continue;
+        uint16_t *bucket = &samples[(size_t) r * buckets + current];
+        *bucket = encodeBytes(decodeBytes(*bucket) + pending[r]);
+        pending[r] = 0;
+    }
+    if (current + 1 < buckets) current++;
+}
+
+bool HostRates::get(const struct in6_addr *ip, struct rate_summary *rates) {
+    int entry = find(ip);
+    if (entry < 0) return false;
+    uint16_t *ring = &samples[(size_t) entry * buckets];
+
+    // Buckets of the period so far, idle ones count as zero
+    unsigned int n = current + 1;
+    vector<unsigned long long> values(n);
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        values[i] = decodeBytes(ring[i]);
+        if (i == current) values[i] += pending[entry];
+        total += values[i];
+    }
+
+    unsigned int rank = (n * 95 + 99) / 100 - 1;
+    nth_element(values.begin(), values.begin() + rank, values.end());
+    rates->p95 = values[rank] * 8 / width;
+    rates->peak = *max_element(values.begin() + rank, values.end()) * 8 / width;
+    rates->avg = total * 8 / ((unsigned long long) n * width);
+    return true;
+}
+
+void HostRates::clear() {
+    memset(tags, 0, mask + 1);
+    count = 0;
+    current = 0;
+}
+
+void HostRates::remove(const struct in6_addr *ip) {
+    int slot = findSlot(ip);
+    if (slot < 0) return;
+    uint32_t entry = index[slot];
+
+    // Backward shift deletion: move up the following entries of the
+    // probe sequence that can take the freed slot
+    unsigned int i = slot;
+    unsigned int j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (tags[j] == 0) break;
+
+        unsigned int home = (HostTable::hash(&hosts[index[j]]) >> 32) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            tags[i] = tags[j];
+            index[i] = index[j];
+            i = j;
+        }
+    }
+    tags[i] = 0;
+
+    // The last ring fills the hole
+    count--;
+    if (entry == count) return;
+    index[findSlot(&hosts[count])] = entry;
+    memcpy(&samples[(size_t) entry * buckets], &samples[(size_t) count * buckets],
+           buckets * sizeof(uint16_t));
+    pending[entry] = pending[count];
+    hosts[entry] = hosts[count];
+}
+
+int HostRates::find(const struct in6_addr *ip) {
+    int slot = findSlot(ip);
+    return slot < 0 ? -1 : (int) index[slot];
+}
+
+int HostRates::findSlot(const struct in6_addr *ip) {
+    uint64_t h = HostTable::hash(ip);
+    unsigned char tag = indexTag(h);
+    unsigned int i = (h >> 32) & mask;
+
+    while (tags[i] != 0) {
+        if (tags[i] == tag && sameAddr(&hosts[index[i]], ip)) return i;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+void HostRates::grow() {
+    unsigned int newCapacity = capacity > 0 ? capacity * 2 : 1024;
+
+    uint16_t *newSamples = new uint16_t[(size_t) newCapacity * buckets];
+    unsigned long long *newPending = new unsigned long long[newCapacity];
+    struct in6_addr *newHosts = new struct in6_addr[newCapacity];
+    if (count > 0) {
+        memcpy(newSamples, samples, (size_t) count * buckets * sizeof(uint16_t));
+        memcpy(newPending, pending, count * sizeof(unsigned long long));
+        memcpy(newHosts, hosts, count * sizeof(struct in6_addr));
+    }
+    delete[] samples;
+    delete[] pending;
+    delete[] hosts;
+    samples = newSamples;
+    pending = newPending;
+    hosts = newHosts;
+    capacity = newCapacity;
+
+    // Index at most half full
+    delete[] tags;
+    delete[] index;
+    unsigned int slots = newCapacity * 2;
+    tags = new unsigned char[slots];
+    index = new uint32_t[slots];
+    memset(tags, 0, slots);
+    mask = slots - 1;
+
+    for (unsigned int r = 0; r < count; r++) {
+        uint64_t h = HostTable::hash(&hosts[r]);
+        unsigned int i = (h >> 32) & mask;
+        while (tags[i] != 0) i = (i + 1) & mask;
+        tags[i] = indexTag(h);
+        index[i] = r;
+    }
+}
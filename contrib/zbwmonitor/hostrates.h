@@ -0,0 +1,105 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(HOSTRATES)
+#define HOSTRATES
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include "hoststats.h"
+
+// Rates of a host during a dump period, bits per second
+struct rate_summary {
+    unsigned long long peak;
+    unsigned long long avg;
+    unsigned long long p95;
+};
+
+/* Per host time series of traffic
+ *
+ * Every host has a ring of fixed width time buckets covering the dump
+ * period. Buckets are 16 bit (5 bit exponent, 11 bit mantissa, relative
+ * error under 0.05%), 1.2KB per host for 600 buckets. The current bucket
+ * is summed exactly apart and only encoded once closed, so the rounding
+ * doesn't add up. All the rings live in one array, indexed by an open
+ * addressing table, hosts removed leave no hole (see remove).
+ *
+ * Buckets are filled by the collector with the traffic of each tick, so
+ * capture threads don't pay anything for it.
+ */
+class HostRates {
+  public:
+    // buckets of width seconds each
+    HostRates(unsigned int buckets, unsigned int width, unsigned int capacity);
+    ~HostRates();
+
+    // Add the traffic of a host to the current bucket
+    void add(const struct in6_addr *ip, unsigned long long bytes);
+
+    // Close the current bucket and move to the next one
+    void tick();
+
+    // Rates of the host in the buckets so far, returns false if unknown
+    bool get(const struct in6_addr *ip, struct rate_summary *rates);
+
+    // Forget a host (evicted), the last ring takes its place
+    void remove(const struct in6_addr *ip);
+
+    // Forget all the hosts and start again from the first bucket
+    void clear();
+
+  private:
+    unsigned int buckets;
+    unsigned int width;
+    unsigned int current;
+
+    // Rings, buckets entries per host, and exact bytes of the current
+    // bucket
+    uint16_t *samples;
+    unsigned long long *pending;
+    struct in6_addr *hosts;
+    unsigned int capacity;
+    unsigned int count;
+
+    // Open addressing index ip -> ring
+    unsigned char *tags;
+    uint32_t *index;
+    unsigned int mask;
+
+    // returns the entry of ip, -1 if not found
+    int find(const struct in6_addr *ip);
+
+    // returns the index slot of ip, -1 if not found
+    int findSlot(const struct in6_addr *ip);
+
+    // Grow room for twice the hosts
+    void grow();
+
+    // Not copyable
+    HostRates(const HostRates&);
+    HostRates& operator=(const HostRates&);
+};
+
+// Bytes sent and received by a host
+inline unsigned long long hostBytes(HostStats *host) {
+    BWSummary *internal = host->getInternalBW();
+    BWSummary *external = host->getExternalBW();
+    return internal->totalSent + internal->totalRecv +
+           external->totalSent + external->totalRecv;
+}
+
+#endif
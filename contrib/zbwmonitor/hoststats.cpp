@@ -0,0 +1,116 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "hoststats.h"
+#include <math.h>
+
+/* HostStats */
+
+HostStats::HostStats() {
+    ip = in6addr_any;
+}
+
+HostStats::HostStats(const struct in6_addr *host) {
+    ip = *host;
+}
+
+void HostStats::addIntPacket(const struct packet_info* pkt) {
+    internal.addPacket(pkt, &ip);
+}
+
+void HostStats::addExtPacket(const struct packet_info* pkt) {
+    external.addPacket(pkt, &ip);
+}
+
+void HostStats::merge(HostStats *other) {
+    internal.merge(other->getInternalBW());
+    external.merge(other->getExternalBW());
+    if (!other->peers.isEmpty()) peers.merge(&other->peers);
+    if (!other->ports.isEmpty()) ports.merge(&other->ports);
+}
+
+
+/* BWSummary */
+BWSummary::BWSummary() {
+    totalRecv = 0;
+    totalSent = 0;
+    numPackets = 0;
+
+    TCP = 0;
+    UDP = 0;
+    ICMP= 0;
+
+    bytesVar = 0;
+    packetsVar = 0;
+}
+
+void BWSummary::addPacket(const struct packet_info* pkt, const struct in6_addr *ip) {
+    unsigned long long len = (unsigned long long) pkt->len * pkt->weight;
+
+    numPackets += pkt->weight;
+    if (sameAddr(&pkt->src, ip)) totalSent += len;
+    if (sameAddr(&pkt->dst, ip)) totalRecv += len;
+
+    // Sampled with probability 1/w: the variance of the estimate of the
+    // sum of x adds up (w^2 - w) x^2 per sampled packet (Horvitz-Thompson).
+    // Only for independent packets: flow sampling keeps or drops whole
+    // flows, its variance comes from per flow sums (not kept, so no
+    // intervals)
+    if (pkt->weight > 1 && !pkt->flowSampled) {
+        double w = pkt->weight;
+        double x = pkt->len;
+        bytesVar += (w * w - w) * x * x;
+        packetsVar += w * w - w;
+    }
+
+    switch (pkt->proto) {
+        case 6: // TCP
+            TCP += len;
+            break;
+
+        case 17: // UDP
+            UDP += len;
+            break;
+
+        case 1:  // ICMP
+        case 58: // ICMPv6
+            ICMP += len;
+            break;
+    }
+}
+
+void BWSummary::merge(const BWSummary *other) {
+    totalRecv += other->totalRecv;
+    totalSent += other->totalSent;
+    numPackets += other->numPackets;
+
+    TCP += other->TCP;
+    UDP += other->UDP;
+    ICMP += other->ICMP;
+
+    bytesVar += other->bytesVar;
+    packetsVar += other->packetsVar;
+}
+
+// 95% confidence, normal approximation
+unsigned long long BWSummary::bytesCI() const {
+    return (unsigned long long) (1.96 * sqrt(bytesVar));
+}
+
+unsigned long long BWSummary::packetsCI() const {
+    return (unsigned long long) (1.96 * sqrt(packetsVar));
+}
@@ -0,0 +1,104 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(HOSTSTATS)
+#define HOSTSTATS
+
+#include <netinet/in.h>
+#include "packet.h"
+#include "hyperloglog.h"
+
+/* Bandwidth usage container */
+class BWSummary {
+  public:
+    BWSummary();
+
+    // Add a packet sent and/or received by ip
+    void addPacket(const struct packet_info* pkt, const struct in6_addr *ip);
+
+    // Add the counters of other summary to this one
+    void merge(const BWSummary *other);
+
+    unsigned long long totalRecv;
+    unsigned long long totalSent;
+    unsigned long long numPackets;
+    // per protocol:
+    unsigned long long TCP;
+    unsigned long long UDP;
+    unsigned long long ICMP;
+
+    // Sampling: variance of the bytes (sent plus received) and packets
+    // estimates, 0 if every packet was accounted
+    double bytesVar;
+    double packetsVar;
+
+    // Half width of the 95% confidence interval of the estimates
+    unsigned long long bytesCI() const;
+    unsigned long long packetsCI() const;
+};
+
+
+/* Bandwidth usage stats for a IP (v4 or v6) */
+class HostStats {
+  public:
+    // Constructors
+    HostStats();
+    HostStats(const struct in6_addr *ip);
+
+    // Add internal traffic package to this host
+    void addIntPacket(const struct packet_info* pkt);
+
+    // Add external traffic package to this host
+    void addExtPacket(const struct packet_info* pkt);
+
+    // Add the counters of other stats for the same host
+    void merge(HostStats *other);
+
+    // Count an external peer (by its address hash) and its protocol and
+    // port as distinct values
+    void addPeer(uint64_t peerHash, uint8_t proto, uint16_t port) {
+        peers.add(peerHash);
+        ports.add(hllHash(((uint64_t) proto << 16) | port));
+    }
+
+    // Host address, IPv4 hosts are IPv4-mapped
+    const struct in6_addr* getIP() { return &ip; }
+    bool isIPv4() { return isMappedIPv4(&ip); }
+
+    BWSummary* getInternalBW() { return &internal; }
+    BWSummary* getExternalBW() { return &external; }
+
+    // Distinct external peers and (protocol, peer port) pairs
+    const HyperLogLog* getPeers() { return &peers; }
+    const HyperLogLog* getPorts() { return &ports; }
+
+    // returns true if no packets were accounted
+    bool isEmpty() { return internal.numPackets == 0 && external.numPackets == 0; }
+
+  private:
+    struct in6_addr ip;
+
+    // Internal and external traffic
+    BWSummary internal;
+    BWSummary external;
+
+    // Distinct values counters (only fed if enabled in the stats)
+    HyperLogLog peers;
+    HyperLogLog ports;
+};
+
+#endif
@@ -0,0 +1,190 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "hosttable.h"
+#include <stdint.h>
+#include <string.h>
+
+static inline unsigned char hostTag(uint64_t hash) {
+    return 0x80 | (hash >> 57);
+}
+
+static unsigned int roundPow2(unsigned int n) {
+    unsigned int cap = HOSTTABLE_MIN_CAPACITY;
+    while (cap < n) cap <<= 1;
+    return cap;
+}
+
+HostTable::HostTable(unsigned int capacity) {
+    capacity = roundPow2(capacity);
+    tags = new unsigned char[capacity];
+    slots = new HostStats[capacity];
+    memset(tags, 0, capacity);
+    mask = capacity - 1;
+    count = 0;
+    limit = 0;
+    sink = NULL;
+    refs = NULL;
+    hand = 0;
+}
+
+HostTable::~HostTable() {
+    delete[] tags;
+    delete[] slots;
+    delete[] refs;
+}
+
+HostStats* HostTable::find(const struct in6_addr *ip) {
+    uint64_t h = hash(ip);
+    unsigned char tag = hostTag(h);
+    unsigned int i = (h >> 32) & mask;
+
+    while (tags[i] != 0) {
+        if (tags[i] == tag && sameAddr(slots[i].getIP(), ip)) return &slots[i];
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+HostStats* HostTable::get(const struct in6_addr *ip) {
+    return get(ip, hash(ip));
+}
+
+HostStats* HostTable::get(const struct in6_addr *ip, uint64_t hash) {
+    unsigned char tag = hostTag(hash);
+    unsigned int i = (hash >> 32) & mask;
+
+    while (tags[i] != 0) {
+        if (tags[i] == tag && sameAddr(slots[i].getIP(), ip)) {
+            if (refs) refs[i] = 1;
+            return &slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    // Not found, make room if full (removals move the probe sequences)
+    if (limit > 0 && count >= limit) {
+        evict();
+        i = (hash >> 32) & mask;
+        while (tags[i] != 0) i = (i + 1) & mask;
+    }
+
+    // Keep load factor under 3/4
+    if ((count + 1) * 4 > capacity() * 3) {
+        resize(capacity() * 2);
+        i = (hash >> 32) & mask;
+        while (tags[i] != 0) i = (i + 1) & mask;
+    }
+
+    tags[i] = tag;
+    slots[i] = HostStats(ip);
+    if (refs) refs[i] = 0;
+    count++;
+    return &slots[i];
+}
+
+void HostTable::setLimit(unsigned int hosts, IHostSink *sink) {
+    limit = hosts;
+    this->sink = sink;
+    delete[] refs;
+    refs = NULL;
+    if (hosts == 0) return;
+
+    // Never grows past the limit
+    reserve(hosts);
+    refs = new unsigned char[capacity()];
+    memset(refs, 1, capacity());
+}
+
+void HostTable::evict() {
+    // At most two sweeps: the first one clears all the bits
+    for (;;) {
+        hand = (hand + 1) & mask;
+        if (tags[hand] == 0) continue;
+        if (refs[hand]) {
+            refs[hand] = 0;
+            continue;
+        }
+        break;
+    }
+
+    sink->evictHost(&slots[hand]);
+    remove(hand);
+}
+
+void HostTable::remove(unsigned int slot) {
+    unsigned int i = slot;
+    unsigned int j = slot;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (tags[j] == 0) break;
+
+        // Hosts whose probe sequence starts after the hole stay
+        unsigned int home = (hash(slots[j].getIP()) >> 32) & mask;
+        if (((j - home) & mask) < ((j - i) & mask)) continue;
+
+        tags[i] = tags[j];
+        slots[i] = slots[j];
+        refs[i] = refs[j];
+        i = j;
+    }
+    tags[i] = 0;
+    count--;
+}
+
+HostStats* HostTable::at(unsigned int slot) {
+    return tags[slot] ? &slots[slot] : NULL;
+}
+
+void HostTable::reserve(unsigned int n) {
+    if (limit > 0 && n > limit) n = limit;
+    unsigned int capacity = roundPow2(n + n / 3 + 1);
+    if (capacity > this->capacity()) resize(capacity);
+}
+
+void HostTable::clear() {
+    memset(tags, 0, capacity());
+    count = 0;
+}
+
+void HostTable::resize(unsigned int capacity) {
+    unsigned char *oldTags = tags;
+    HostStats *oldSlots = slots;
+    unsigned int oldCapacity = this->capacity();
+
+    unsigned char *oldRefs = refs;
+
+    tags = new unsigned char[capacity];
+    slots = new HostStats[capacity];
+    memset(tags, 0, capacity);
+    mask = capacity - 1;
+    if (oldRefs) refs = new unsigned char[capacity];
+
+    for (unsigned int s = 0; s < oldCapacity; s++) {
+        if (oldTags[s] == 0) continue;
+
+        unsigned int i = (hash(oldSlots[s].getIP()) >> 32) & mask;
+        while (tags[i] != 0) i = (i + 1) & mask;
+        tags[i] = oldTags[s];
+        slots[i] = oldSlots[s];
+        if (refs) refs[i] = oldRefs[s];
+    }
+
+    delete[] oldTags;
+    delete[] oldSlots;
+    delete[] oldRefs;
+}
@@ -0,0 +1,129 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(HOSTTABLE)
+#define HOSTTABLE
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include "hoststats.h"
+
+// Default number of slots (always a power of two)
+const unsigned int HOSTTABLE_MIN_CAPACITY = 1024;
+
+// Receives the hosts evicted from a bounded table
+class IHostSink {
+  public:
+    virtual ~IHostSink() {}
+
+    // The host is removed right after the call
+    virtual void evictHost(HostStats *host) = 0;
+};
+
+/* Open addressing hash table of hosts
+ *
+ * HostStats are stored inline in a flat array with linear probing. A
+ * parallel array of one byte tags (0 means empty slot) is scanned first,
+ * so a probe only touches the stats of the host it is looking for.
+ *
+ * Keys are IPv6 addresses (IPv4 ones mapped), both families go through
+ * the same single table lookup.
+ *
+ * The number of hosts can be bounded (setLimit). A new host beyond the
+ * limit evicts an idle one, picked with CLOCK: every lookup sets the
+ * reference bit of its host and the clock hand sweeps the table clearing
+ * them, the first host found without it (not looked up since the hand
+ * last passed) goes. New hosts start without it, so the ones seen only
+ * once go before the ones coming back.
+ */
+class HostTable {
+  public:
+    HostTable(unsigned int capacity = HOSTTABLE_MIN_CAPACITY);
+    ~HostTable();
+
+    // returns the stats for the given ip (creates them if don't exist)
+    // pointers are only valid until the next insertion (table may grow)
+    HostStats* get(const struct in6_addr *ip);
+
+    // Same, with the hash of ip already calculated
+    HostStats* get(const struct in6_addr *ip, uint64_t hash);
+
+    // Hash of an address
+    static uint64_t hash(const struct in6_addr *ip);
+
+    // returns the stats for the given ip or NULL if not found
+    HostStats* find(const struct in6_addr *ip);
+
+    // Preallocate room for n hosts
+    void reserve(unsigned int n);
+
+    // Keep at most hosts hosts (0 means no limit), evicting the idle
+    // ones to sink to make room for new ones
+    void setLimit(unsigned int hosts, IHostSink *sink);
+
+    // Remove all hosts (allocated capacity is kept)
+    void clear();
+
+    unsigned int size() { return count; }
+    unsigned int capacity() { return mask + 1; }
+
+    // Slot access to walk the table, returns NULL for empty slots
+    HostStats* at(unsigned int slot);
+
+  private:
+    unsigned char *tags;
+    HostStats *slots;
+    unsigned int mask;
+    unsigned int count;
+
+    // Hosts limit, CLOCK reference bits and hand (only with a limit)
+    unsigned int limit;
+    IHostSink *sink;
+    unsigned char *refs;
+    unsigned int hand;
+
+    // Pass the host under the next CLOCK victim to the sink and remove it
+    void evict();
+
+    // Remove the host of a slot, shifting back the ones probed after it
+    void remove(unsigned int slot);
+
+    // Rehash all the hosts into a table of the given capacity
+    void resize(unsigned int capacity);
+
+    // Not copyable
+    HostTable(const HostTable&);
+    HostTable& operator=(const HostTable&);
+};
+
+// Hash both address halves, slot index from the middle bits and tag from
+// the top ones. IPv4-mapped addresses take the same path (their varying
+// bytes are all in the upper word, hence the folding), so dual-stack
+// traffic costs one hash and one probe sequence
+inline uint64_t HostTable::hash(const struct in6_addr *ip) {
+    uint64_t hi, lo;
+    memcpy(&hi, ip->s6_addr, 8);
+    memcpy(&lo, ip->s6_addr + 8, 8);
+
+    uint64_t h = hi * 0xC2B2AE3D27D4EB4FULL ^ lo;
+    h ^= h >> 32;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+#endif
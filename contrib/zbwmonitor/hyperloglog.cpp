@@ -0,0 +1,125 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "hyperloglog.h"
+#include <math.h>
+#include <string.h>
+
+HyperLogLog::HyperLogLog() {
+    dense = NULL;
+    memset(sparse, 0, sizeof(sparse));
+}
+
+HyperLogLog::HyperLogLog(const HyperLogLog &other) {
+    dense = NULL;
+    *this = other;
+}
+
+HyperLogLog& HyperLogLog::operator=(const HyperLogLog &other) {
+    if (this == &other) return *this;
+
+    // Sparse counters (most of them) are plain copies
+    if (other.dense == NULL) {
+        delete[] dense;
+        dense = NULL;
+        memcpy(sparse, other.sparse, sizeof(sparse));
+        return *this;
+    }
+    if (dense == NULL) dense = new uint8_t[HLL_REGISTERS];
+    memcpy(dense, other.dense, HLL_REGISTERS);
+    return *this;
+}
+
+HyperLogLog::~HyperLogLog() {
+    delete[] dense;
+}
+
+void HyperLogLog::addSparse(unsigned int index, uint8_t rank) {
+    uint16_t entry = (index << 8) | rank;
+    for (int i = 0; i < HLL_SPARSE; i++) {
+        if (sparse[i] == 0) {
+            sparse[i] = entry;
+            return;
+        }
+        if ((sparse[i] >> 8) == index) {
+            if (rank > (sparse[i] & 0xff)) sparse[i] = entry;
+            return;
+        }
+    }
+
+    toDense();
+    if (rank > dense[index]) dense[index] = rank;
+}
+
+void HyperLogLog::toDense() {
+    dense = new uint8_t[HLL_REGISTERS];
+    memset(dense, 0, HLL_REGISTERS);
+    for (int i = 0; i < HLL_SPARSE && sparse[i] != 0; i++) {
+        dense[sparse[i] >> 8] = sparse[i] & 0xff;
+    }
+}
+
+void HyperLogLog::merge(const HyperLogLog *other) {
+    if (other->dense == NULL) {
+        for (int i = 0; i < HLL_SPARSE && other->sparse[i] != 0; i++) {
+            unsigned int index = other->sparse[i] >> 8;
+            uint8_t rank = other->sparse[i] & 0xff;
+            if (dense == NULL) {
+                addSparse(index, rank);
+            } else {
+                uint8_t r = dense[index];
+                dense[index] = rank > r ? rank : r;
+            }
+        }
+        return;
+    }
+
+    if (dense == NULL) toDense();
+    for (unsigned int i = 0; i < HLL_REGISTERS; i++) {
+        uint8_t r = other->dense[i];
+        dense[i] = r > dense[i] ? r : dense[i];
+    }
+}
+
+unsigned long long HyperLogLog::estimate() const {
+    double m = HLL_REGISTERS;
+    double sum = 0;
+    unsigned int zeros = 0;
+
+    if (dense == NULL) {
+        for (int i = 0; i < HLL_SPARSE && sparse[i] != 0; i++) {
+            sum += ldexp(1.0, -(sparse[i] & 0xff));
+        }
+        for (int i = 0; i < HLL_SPARSE; i++) {
+            if (sparse[i] == 0) zeros++;
+        }
+        zeros += HLL_REGISTERS - HLL_SPARSE;
+        sum += zeros;
+    } else {
+        for (unsigned int i = 0; i < HLL_REGISTERS; i++) {
+            sum += ldexp(1.0, -dense[i]);
+            if (dense[i] == 0) zeros++;
+        }
+    }
+
+    double alpha = 0.7213 / (1 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+
+    // Small range correction (linear counting)
+    if (estimate <= 2.5 * m && zeros > 0) estimate = m * log(m / zeros);
+    return (unsigned long long) (estimate + 0.5);
+}
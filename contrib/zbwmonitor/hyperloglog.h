@@ -0,0 +1,89 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(HYPERLOGLOG)
+#define HYPERLOGLOG
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 2^HLL_PRECISION registers (one byte each) when dense, standard error
+// 1.04 / sqrt(registers), 6.5%
+const int HLL_PRECISION = 8;
+const unsigned int HLL_REGISTERS = 1 << HLL_PRECISION;
+
+// Registers kept inline while sparse
+const int HLL_SPARSE = 4;
+
+/* HyperLogLog distinct values counter
+ *
+ * Quiet hosts only set a few registers: they are kept inline as sparse
+ * (index, rank) entries, 16 bytes in all. When they don't fit anymore
+ * the counter switches to the dense registers array, HLL_REGISTERS
+ * bytes on the heap, so the memory of a counter is always bounded.
+ *
+ * Values are added by their 64 bit hash: the top bits pick the register
+ * and the leading zeros of the rest give the rank.
+ */
+class HyperLogLog {
+  public:
+    HyperLogLog();
+    HyperLogLog(const HyperLogLog &other);
+    HyperLogLog& operator=(const HyperLogLog &other);
+    ~HyperLogLog();
+
+    // Add a value by its hash, registers are updated without branches
+    void add(uint64_t hash) {
+        unsigned int index = hash >> (64 - HLL_PRECISION);
+        uint8_t rank = __builtin_clzll((hash << HLL_PRECISION) | (1ULL << (HLL_PRECISION - 1))) + 1;
+        if (dense == NULL) {
+            addSparse(index, rank);
+            return;
+        }
+        uint8_t r = dense[index];
+        dense[index] = rank > r ? rank : r;
+    }
+
+    // Add the values of other (union)
+    void merge(const HyperLogLog *other);
+
+    // returns true if no value was added
+    bool isEmpty() const { return dense == NULL && sparse[0] == 0; }
+
+    // Estimated number of distinct values
+    unsigned long long estimate() const;
+
+  private:
+    uint8_t *dense;                 // NULL while sparse
+    uint16_t sparse[HLL_SPARSE];    // index << 8 | rank, 0 if free
+
+    void addSparse(unsigned int index, uint8_t rank);
+
+    // Move the sparse entries to a new registers array
+    void toDense();
+};
+
+// Hash of a small value (ports), murmur3 finalizer
+inline uint64_t hllHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+#endif
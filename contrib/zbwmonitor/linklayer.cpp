@@ -0,0 +1,56 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "linklayer.h"
+
+bool decodeEthertype(uint16_t type, const u_char *&pkt, unsigned int &caplen,
+                     struct packet_info *info) {
+    for (int tags = 0; ; tags++) {
+        switch (type) {
+            case ETH_IPV4:
+            case ETH_IPV6:
+                return true;
+
+            case ETH_VLAN:
+            case ETH_QINQ:
+            case ETH_QINQ_OLD:
+                // The innermost tag is kept (customer VLAN on QinQ)
+                if (tags == MAX_VLAN_TAGS || caplen <= VLAN_TAG_LEN) return false;
+                info->vlan = readU16(pkt) & 0xfff;
+                type = readU16(pkt + 2);
+                pkt += VLAN_TAG_LEN;
+                caplen -= VLAN_TAG_LEN;
+                break;
+
+            case ETH_PPPOE_SESSION:
+                return decodePPPoE(pkt, caplen);
+
+            default:
+                return false;
+        }
+    }
+}
+
+bool decodePPPoE(const u_char *&pkt, unsigned int &caplen) {
+    // Version and type 1, session data code 0
+    if (caplen <= PPPOE_HDR_LEN || pkt[0] != 0x11 || pkt[1] != 0) return false;
+
+    uint16_t proto = readU16(pkt + 6);
+    pkt += PPPOE_HDR_LEN;
+    caplen -= PPPOE_HDR_LEN;
+    return proto == PPP_PROTO_IPV4 || proto == PPP_PROTO_IPV6;
+}
@@ -0,0 +1,138 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(LINKLAYER)
+#define LINKLAYER
+
+#include <pcap.h>
+#include <stdint.h>
+#include "packet.h"
+
+#if !defined(DLT_LINUX_SLL2)
+#define DLT_LINUX_SLL2 276
+#endif
+
+/* Link layer decoding
+ *
+ * decodeLink<DLT>() skips the link layer headers of a pcap link type,
+ * leaving pkt and caplen at the IP header. It's specialized per link type
+ * so each capture handler only carries the code of its own, and plain
+ * Ethernet frames (IP right after the MAC header) take a single branch.
+ * VLAN tags and PPPoE sessions are unwrapped out of line.
+ */
+
+// Ethertypes
+const uint16_t ETH_IPV4 = 0x0800;
+const uint16_t ETH_IPV6 = 0x86dd;
+const uint16_t ETH_VLAN = 0x8100;
+const uint16_t ETH_QINQ = 0x88a8;
+const uint16_t ETH_QINQ_OLD = 0x9100;
+const uint16_t ETH_PPPOE_SESSION = 0x8864;
+
+// PPP protocols
+const uint16_t PPP_PROTO_IPV4 = 0x0021;
+const uint16_t PPP_PROTO_IPV6 = 0x0057;
+
+// Max number of VLAN tags walked (QinQ has two)
+const int MAX_VLAN_TAGS = 4;
+
+// Header lengths
+const unsigned int ETHERNET_HDR_LEN = 14;
+const unsigned int SLL_HDR_LEN = 16;
+const unsigned int SLL2_HDR_LEN = 20;
+const unsigned int PPPOE_HDR_LEN = 8;   // PPPoE and PPP protocol
+const unsigned int VLAN_TAG_LEN = 4;
+
+// Longest link layer decoded: cooked v2 header, VLAN tags and PPPoE
+const unsigned int LINK_MAX_HDR_LEN = SLL2_HDR_LEN + MAX_VLAN_TAGS * VLAN_TAG_LEN + PPPOE_HDR_LEN;
+
+inline uint16_t readU16(const u_char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Skip the VLAN tags and PPPoE session headers of a packet with the
+// given ethertype, returns false if there is no IP inside
+bool decodeEthertype(uint16_t type, const u_char *&pkt, unsigned int &caplen,
+                     struct packet_info *info);
+
+// Skip a PPPoE session header, returns false if there is no IP inside
+bool decodePPPoE(const u_char *&pkt, unsigned int &caplen);
+
+// Skip the link layer of the given type, returns false if the packet is
+// not IP (or truncated). Only the link types specialized below exist
+template <int DLT>
+bool decodeLink(const u_char *&pkt, unsigned int &caplen, struct packet_info *info);
+
+// Ethernet, with 802.1Q / 802.1ad tags and PPPoE sessions
+template <>
+inline bool decodeLink<DLT_EN10MB>(const u_char *&pkt, unsigned int &caplen,
+                                   struct packet_info *info) {
+    if (caplen <= ETHERNET_HDR_LEN) return false;
+    uint16_t type = readU16(pkt + 12);
+    pkt += ETHERNET_HDR_LEN;
+    caplen -= ETHERNET_HDR_LEN;
+    info->vlan = 0;
+
+    if (type == ETH_IPV4 || type == ETH_IPV6) return true;
+    return decodeEthertype(type, pkt, caplen, info);
+}
+
+// Linux cooked capture (any device, PPP links)
+template <>
+inline bool decodeLink<DLT_LINUX_SLL>(const u_char *&pkt, unsigned int &caplen,
+                                      struct packet_info *info) {
+    if (caplen <= SLL_HDR_LEN) return false;
+    uint16_t type = readU16(pkt + 14);
+    pkt += SLL_HDR_LEN;
+    caplen -= SLL_HDR_LEN;
+    info->vlan = 0;
+
+    if (type == ETH_IPV4 || type == ETH_IPV6) return true;
+    return decodeEthertype(type, pkt, caplen, info);
+}
+
+// Linux cooked capture v2
+template <>
+inline bool decodeLink<DLT_LINUX_SLL2>(const u_char *&pkt, unsigned int &caplen,
+                                       struct packet_info *info) {
+    if (caplen <= SLL2_HDR_LEN) return false;
+    uint16_t type = readU16(pkt);
+    pkt += SLL2_HDR_LEN;
+    caplen -= SLL2_HDR_LEN;
+    info->vlan = 0;
+
+    if (type == ETH_IPV4 || type == ETH_IPV6) return true;
+    return decodeEthertype(type, pkt, caplen, info);
+}
+
+// PPPoE without Ethernet header (BSD)
+template <>
+inline bool decodeLink<DLT_PPP_ETHER>(const u_char *&pkt, unsigned int &caplen,
+                                      struct packet_info *info) {
+    info->vlan = 0;
+    return decodePPPoE(pkt, caplen);
+}
+
+// Raw IP (tunnels, PPP links on some systems)
+template <>
+inline bool decodeLink<DLT_RAW>(const u_char *&pkt, unsigned int &caplen,
+                                struct packet_info *info) {
+    info->vlan = 0;
+    return caplen > 0;
+}
+
+#endif
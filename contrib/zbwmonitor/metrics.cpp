@@ -0,0 +1,125 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+Metrics::Metrics() {
+    pthread_mutex_init(&lock, NULL);
+    gettimeofday(&lastTick, NULL);
+    hosts = 0;
+    hostCapacity = 0;
+    lastDump = 0;
+    dumpTime = 0;
+    memset(dumpLatency, 0, sizeof(dumpLatency));
+}
+
+Metrics::~Metrics() {
+    for (unsigned int i = 0; i < captures.size(); i++) free(captures[i]);
+    pthread_mutex_destroy(&lock);
+}
+
+struct capture_metrics* Metrics::addCapture() {
+    void *mem;
+    if (posix_memalign(&mem, 64, sizeof(struct capture_metrics)) != 0) return NULL;
+    struct capture_metrics *m = (struct capture_metrics*) mem;
+    memset(m, 0, sizeof(*m));
+
+    struct capture_summary empty;
+    memset(&empty, 0, sizeof(empty));
+
+    pthread_mutex_lock(&lock);
+    captures.push_back(m);
+    last.push_back(*m);
+    rates.push_back(empty);
+    pthread_mutex_unlock(&lock);
+    return m;
+}
+
+void Metrics::removeCapture(struct capture_metrics *capture) {
+    pthread_mutex_lock(&lock);
+    if (!captures.empty() && captures.back() == capture) {
+        captures.pop_back();
+        last.pop_back();
+        rates.pop_back();
+        free(capture);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// Per packet cost of the cycles spent on count packets
+static uint64_t perPacket(uint64_t cycles, uint64_t count) {
+    return count > 0 ? cycles / count : 0;
+}
+
+void Metrics::tick() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    pthread_mutex_lock(&lock);
+    uint64_t usecs = elapsedUsecs(&lastTick, &now);
+    for (unsigned int i = 0; i < captures.size(); i++) {
+        struct capture_metrics cur = *captures[i];
+        struct capture_metrics *prev = &last[i];
+        struct capture_summary *r = &rates[i];
+
+        uint64_t accounted = cur.accounted - prev->accounted;
+        r->pps = usecs > 0 ? (cur.packets - prev->packets) * 1000000 / usecs : 0;
+        r->decodeCycles = perPacket(cur.decodeCycles - prev->decodeCycles,
+                                    cur.decodeSamples - prev->decodeSamples);
+        r->hostCycles = perPacket(cur.hostCycles - prev->hostCycles, accounted);
+        r->flowCycles = perPacket(cur.flowCycles - prev->flowCycles, accounted);
+        *prev = cur;
+    }
+    lastTick = now;
+    pthread_mutex_unlock(&lock);
+}
+
+void Metrics::setHosts(unsigned int hosts, unsigned int capacity) {
+    pthread_mutex_lock(&lock);
+    this->hosts = hosts;
+    hostCapacity = capacity;
+    pthread_mutex_unlock(&lock);
+}
+
+void Metrics::addDump(uint64_t usecs) {
+    unsigned int bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && usecs >= (1000ULL << bucket)) bucket++;
+
+    pthread_mutex_lock(&lock);
+    lastDump = usecs;
+    dumpLatency[bucket]++;
+    dumpTime += usecs;
+    pthread_mutex_unlock(&lock);
+}
+
+void Metrics::snapshot(struct metrics_snapshot *s) {
+    pthread_mutex_lock(&lock);
+    s->captures = rates;
+    for (unsigned int i = 0; i < captures.size(); i++) {
+        s->captures[i].counters = *captures[i];
+    }
+    s->hosts = hosts;
+    s->hostCapacity = hostCapacity;
+    s->lastDump = lastDump;
+    memcpy(s->dumpLatency, dumpLatency, sizeof(dumpLatency));
+    s->dumpTime = dumpTime;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,154 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(METRICS)
+#define METRICS
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+// Dump latency histogram: bucket i counts the dumps taking less than
+// 2^i ms (and more than the previous bucket), the last one the slower
+const unsigned int METRICS_LATENCY_BUCKETS = 12;
+
+// Packets decoding cost is sampled once every METRICS_SAMPLE_RATE
+// packets (power of two)
+const uint64_t METRICS_SAMPLE_RATE = 64;
+
+// Cycle counter, TSC on x86 (nanoseconds elsewhere)
+inline uint64_t readCycles() {
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Counters of a capture thread
+ *
+ * Only updated by the capture thread, other threads read them without
+ * locking (values may lag a bit). Each block has its own cache lines.
+ */
+struct capture_metrics {
+    uint64_t packets;       // frames handed over by the capture
+    uint64_t nonIP;         // not IP or in an unknown encapsulation
+    uint64_t truncated;     // IP header not fully captured or malformed
+
+    // Capture statistics, updated every second
+    uint64_t kernelRecv;    // received by the kernel (filter passed)
+    uint64_t kernelDrops;   // dropped for lack of buffer room
+    uint64_t ifDrops;       // dropped by the interface
+
+    uint64_t decodeCycles;  // spent decoding the sampled packets
+    uint64_t decodeSamples;
+    uint64_t hostCycles;    // spent accounting batches to hosts
+    uint64_t flowCycles;    // and to flows
+    uint64_t accounted;     // packets in those batches
+
+    uint32_t flows;         // flow table usage, updated every second
+    uint32_t flowCapacity;
+} __attribute__((aligned(64)));
+
+// Metrics of a capture thread over the last tick
+struct capture_summary {
+    struct capture_metrics counters;    // totals
+
+    uint64_t pps;           // packets per second
+    uint64_t decodeCycles;  // per packet cost of each stage
+    uint64_t hostCycles;
+    uint64_t flowCycles;
+};
+
+// Copy of all the metrics
+struct metrics_snapshot {
+    vector<struct capture_summary> captures;
+
+    // Hosts in the stats of the last tick and room for them
+    uint32_t hosts;
+    uint32_t hostCapacity;
+
+    // Last dump duration, histogram and total time of all of them
+    uint64_t lastDump;      // microseconds
+    uint64_t dumpLatency[METRICS_LATENCY_BUCKETS];
+    uint64_t dumpTime;      // microseconds
+};
+
+
+/* Self instrumentation metrics
+ *
+ * Capture threads update their own counters, the collector moves the
+ * per tick rates forward and reports the stats and dump figures.
+ */
+class Metrics {
+  public:
+    Metrics();
+    ~Metrics();
+
+    // Register a capture thread, returns its counters
+    struct capture_metrics* addCapture();
+
+    // Unregister the last capture thread registered (it never started)
+    void removeCapture(struct capture_metrics *capture);
+
+    // A tick ended, compute the rates since the previous one
+    void tick();
+
+    // Hosts kept by the stats and room for them
+    void setHosts(unsigned int hosts, unsigned int capacity);
+
+    // A dump took usecs microseconds
+    void addDump(uint64_t usecs);
+
+    // Copy the current metrics
+    void snapshot(struct metrics_snapshot *s);
+
+  private:
+    pthread_mutex_t lock;
+
+    // Everything below is protected by lock
+    vector<struct capture_metrics*> captures;
+
+    // Counters at the last tick and rates since the previous one
+    vector<struct capture_metrics> last;
+    vector<struct capture_summary> rates;
+    struct timeval lastTick;
+
+    uint32_t hosts;
+    uint32_t hostCapacity;
+    uint64_t lastDump;
+    uint64_t dumpLatency[METRICS_LATENCY_BUCKETS];
+    uint64_t dumpTime;
+
+    Metrics(const Metrics&);
+    Metrics& operator=(const Metrics&);
+};
+
+// Microseconds from start to end
+inline uint64_t elapsedUsecs(const struct timeval *start, const struct timeval *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000LL + (end->tv_usec - start->tv_usec);
+}
+
+#endif
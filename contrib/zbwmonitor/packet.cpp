@@ -0,0 +1,134 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "packet.h"
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <arpa/inet.h>
+
+// Max number of IPv6 extension headers to walk
+const int MAX_EXT_HEADERS = 8;
+
+// Read TCP/UDP ports from the L4 header at pkt + offset, if captured
+static void decodePorts(const u_char *pkt, unsigned int offset, unsigned int caplen,
+                        struct packet_info *info) {
+    info->sport = 0;
+    info->dport = 0;
+    if (info->proto != IPPROTO_TCP && info->proto != IPPROTO_UDP) return;
+    if (offset + 4 > caplen) return;
+
+    info->sport = (pkt[offset] << 8) | pkt[offset + 1];
+    info->dport = (pkt[offset + 2] << 8) | pkt[offset + 3];
+}
+
+bool decodeIPv4(const u_char *pkt, unsigned int caplen, struct packet_info *info) {
+    if (caplen < sizeof(struct ip)) return false;
+
+    // Malformed header length, the ports would be read from the IP
+    // header itself. Headers past caplen only lose the ports
+    const struct ip *ip = (const struct ip*) pkt;
+    if (ip->ip_hl < 5) return false;
+
+    mapIPv4(ip->ip_src.s_addr, &info->src);
+    mapIPv4(ip->ip_dst.s_addr, &info->dst);
+    info->len = ntohs(ip->ip_len);
+    info->proto = ip->ip_p;
+    info->ipv6 = false;
+
+    // Only the first fragment carries the L4 header
+    if (ntohs(ip->ip_off) & IP_OFFMASK) {
+        info->sport = info->dport = 0;
+    } else {
+        decodePorts(pkt, ip->ip_hl * 4, caplen, info);
+    }
+    return true;
+}
+
+// IPv6 extension headers walked by decodeIPv6
+static inline bool isExtHeader(unsigned char next) {
+    switch (next) {
+        case IPPROTO_HOPOPTS:
+        case IPPROTO_ROUTING:
+        case IPPROTO_DSTOPTS:
+        case 135: // Mobility
+        case IPPROTO_AH:
+        case IPPROTO_FRAGMENT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool decodeIPv6(const u_char *pkt, unsigned int caplen, struct packet_info *info) {
+    if (caplen < sizeof(struct ip6_hdr)) return false;
+
+    const struct ip6_hdr *ip6 = (const struct ip6_hdr*) pkt;
+    info->src = ip6->ip6_src;
+    info->dst = ip6->ip6_dst;
+    info->len = ntohs(ip6->ip6_plen) + sizeof(struct ip6_hdr);
+    info->ipv6 = true;
+
+    // Walk the extension headers to find the L4 protocol
+    unsigned char next = ip6->ip6_nxt;
+    unsigned int offset = sizeof(struct ip6_hdr);
+    bool firstFragment = true;
+    for (int i = 0; i < MAX_EXT_HEADERS; i++) {
+        unsigned int hdrlen;
+        const u_char *hdr = pkt + offset;
+
+        // Extension headers take 8 bytes at least, upper layer ones are
+        // checked when decoding their ports
+        if (isExtHeader(next) && offset + 8 > caplen) break;
+
+        switch (next) {
+            case IPPROTO_HOPOPTS:
+            case IPPROTO_ROUTING:
+            case IPPROTO_DSTOPTS:
+            case 135: // Mobility
+                hdrlen = (hdr[1] + 1) * 8;
+                break;
+
+            case IPPROTO_AH:
+                hdrlen = (hdr[1] + 2) * 4;
+                break;
+
+            case IPPROTO_FRAGMENT:
+                // Next header is there even on non first fragments
+                hdrlen = 8;
+                if (((hdr[2] << 8) | hdr[3]) & 0xfff8) firstFragment = false;
+                break;
+
+            default:
+                // Upper layer (or ESP / no next header)
+                info->proto = next;
+                if (firstFragment) {
+                    decodePorts(pkt, offset, caplen, info);
+                } else {
+                    info->sport = info->dport = 0;
+                }
+                return true;
+        }
+
+        next = hdr[0];
+        offset += hdrlen;
+    }
+
+    // Truncated or too many headers, protocol unknown
+    info->proto = IPPROTO_NONE;
+    info->sport = info->dport = 0;
+    return true;
+}
@@ -0,0 +1,79 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(PACKET)
+#define PACKET
+
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Decoded packet, all the stats need to know about it
+ *
+ * IPv4 addresses are stored IPv4-mapped (::ffff:a.b.c.d) so both
+ * families share the same host keys.
+ */
+struct packet_info {
+    struct in6_addr src;
+    struct in6_addr dst;
+    unsigned int len;       // IP packet length (headers included)
+    unsigned char proto;    // L4 protocol (after IPv6 extension headers)
+    bool ipv6;
+    uint16_t sport;         // TCP/UDP ports (host order), 0 if unknown
+    uint16_t dport;
+    uint16_t vlan;          // 802.1Q VLAN id (innermost tag), 0 if untagged
+    uint16_t weight;        // packets it stands for (1 unless sampling)
+    bool flowSampled;       // weight applies to its whole flow (flow sampling)
+};
+
+// Capture length needed past the link layer: IPv4 header with options
+// or IPv6 header with up to 16 bytes of extension headers (fragment and
+// a short options one), followed by the L4 ports
+const unsigned int IP_CAPTURE_SIZE = 64;
+
+// Number of VLAN ids
+const unsigned int VLAN_COUNT = 4096;
+
+// Max number of packets handed to the stats at once
+const unsigned int PACKET_BATCH_SIZE = 256;
+
+// Decode the IPv4 packet starting at pkt, returns false if truncated
+bool decodeIPv4(const u_char *pkt, unsigned int caplen, struct packet_info *info);
+
+// Decode the IPv6 packet starting at pkt, returns false if truncated
+bool decodeIPv6(const u_char *pkt, unsigned int caplen, struct packet_info *info);
+
+// Store an IPv4 address as IPv4-mapped IPv6
+inline void mapIPv4(in_addr_t ip, struct in6_addr *addr) {
+    memset(addr->s6_addr, 0, 10);
+    addr->s6_addr[10] = 0xff;
+    addr->s6_addr[11] = 0xff;
+    memcpy(addr->s6_addr + 12, &ip, 4);
+}
+
+// returns true if the address is IPv4-mapped
+inline bool isMappedIPv4(const struct in6_addr *addr) {
+    return IN6_IS_ADDR_V4MAPPED(addr);
+}
+
+// Compare two addresses
+inline bool sameAddr(const struct in6_addr *a, const struct in6_addr *b) {
+    return memcmp(a, b, sizeof(struct in6_addr)) == 0;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "prefixtrie.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+PrefixTrie::PrefixTrie() {
+    build();
+}
+
+void PrefixTrie::add(const unsigned char *addr, int len, int value) {
+    prefix p;
+    memset(p.addr, 0, sizeof(p.addr));
+    memcpy(p.addr, addr, (len + 7) / 8);
+    p.len = len;
+    p.value = value;
+    prefixes.push_back(p);
+}
+
+bool PrefixTrie::shorter(const prefix &a, const prefix &b) {
+    return a.len < b.len;
+}
+
+void PrefixTrie::build() {
+    slot empty;
+    empty.value = -1;
+    empty.child = -1;
+
+    rootValue = -1;
+    nodes.assign(256, empty);
+
+    // Insert shorter prefixes first so longer ones overwrite them when
+    // they are expanded over the same slots
+    vector<prefix> sorted(prefixes);
+    stable_sort(sorted.begin(), sorted.end(), shorter);
+
+    for (vector<prefix>::iterator p = sorted.begin(); p != sorted.end(); ++p) {
+        if (p->len == 0) {
+            rootValue = p->value;
+            continue;
+        }
+
+        // Walk (creating them) the nodes down to the last stride
+        int depth = (p->len - 1) / 8;
+        int node = 0;
+        for (int i = 0; i < depth; i++) {
+            int s = node * 256 + p->addr[i];
+            if (nodes[s].child < 0) {
+                nodes[s].child = nodes.size() / 256;
+                nodes.insert(nodes.end(), 256, empty);
+            }
+            node = nodes[s].child;
+        }
+
+        // Expand the remaining bits over the slots they cover
+        int bits = p->len - depth * 8;
+        int first = p->addr[depth] & (0xff << (8 - bits)) & 0xff;
+        int count = 1 << (8 - bits);
+        for (int i = first; i < first + count; i++) {
+            nodes[node * 256 + i].value = p->value;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(PREFIXTRIE)
+#define PREFIXTRIE
+
+#include <vector>
+
+using namespace std;
+
+/* Longest prefix match table
+ *
+ * Multibit trie with 8 bit strides and controlled prefix expansion, a
+ * lookup of a N bytes address takes at most N memory accesses. Prefixes
+ * are collected with add() and compiled into the trie by build().
+ */
+class PrefixTrie {
+  public:
+    PrefixTrie();
+
+    // Add the first len bits of addr (network byte order) as a prefix,
+    // lookups matching it will return value (>= 0)
+    void add(const unsigned char *addr, int len, int value);
+
+    // Compile the added prefixes, must be called before any lookup
+    void build();
+
+    // returns the value of the longest prefix matching addr or -1
+    int lookup(const unsigned char *addr) const;
+
+    // Number of prefixes added
+    unsigned int size() const { return prefixes.size(); }
+
+  private:
+    struct prefix {
+        unsigned char addr[16];
+        int len;
+        int value;
+    };
+
+    // Trie node slot: value of the prefix ending here and next node
+    struct slot {
+        int value;
+        int child;
+    };
+
+    vector<prefix> prefixes;
+
+    // Nodes are 256 consecutive slots, root is the first one
+    vector<slot> nodes;
+
+    // Value of the zero length prefix
+    int rootValue;
+
+    static bool shorter(const prefix &a, const prefix &b);
+};
+
+inline int PrefixTrie::lookup(const unsigned char *addr) const {
+    int value = rootValue;
+    const slot *node = &nodes[0];
+
+    for (int i = 0; ; i++) {
+        const slot *s = &node[addr[i]];
+        if (s->value >= 0) value = s->value;
+        if (s->child < 0) return value;
+        node = &nodes[s->child * 256];
+    }
+}
+
+#endif
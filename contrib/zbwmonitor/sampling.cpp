@@ -0,0 +1,76 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "sampling.h"
+#include <math.h>
+#include <string.h>
+
+// 64 bit finalizer (murmur3)
+static inline uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+Sampler::Sampler() {
+    mode = SAMPLING_NONE;
+    rate = 1;
+    gap = 0;
+    state = 1;
+    logSkip = 0;
+    salt = 0;
+    threshold = 0;
+}
+
+void Sampler::setup(sampling_mode mode, unsigned int rate, uint64_t salt, uint64_t seed) {
+    if (rate > SAMPLING_MAX_RATE) rate = SAMPLING_MAX_RATE;
+    if (rate <= 1) mode = SAMPLING_NONE;
+
+    this->mode = mode;
+    this->rate = mode == SAMPLING_NONE ? 1 : rate;
+    this->salt = salt;
+    threshold = (uint32_t) (0x100000000ULL / this->rate);
+    logSkip = log(1.0 - 1.0 / this->rate);
+    state = mix(seed) | 1;
+    gap = mode == SAMPLING_RANDOM ? nextGap() : 0;
+}
+
+uint32_t Sampler::nextGap() {
+    // xorshift64*, uniform in (0, 1]
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    double u = ((state * 0x2545F4914F6CDD1DULL >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+    double g = floor(log(u) / logSkip);
+    return g < 4294967295.0 ? (uint32_t) g : 4294967295U;
+}
+
+uint64_t Sampler::endpoint(const struct in6_addr *addr, uint16_t port) const {
+    uint64_t hi, lo;
+    memcpy(&hi, addr->s6_addr, 8);
+    memcpy(&lo, addr->s6_addr + 8, 8);
+    return mix(hi ^ mix(lo ^ salt ^ ((uint64_t) port << 48)));
+}
+
+bool Sampler::sampleFlow(const struct packet_info *pkt) const {
+    // Sides are added up, so both directions get the same hash
+    uint64_t h = mix(endpoint(&pkt->src, pkt->sport) + endpoint(&pkt->dst, pkt->dport) + pkt->proto);
+    return (h >> 32) < threshold;
+}
@@ -0,0 +1,90 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(SAMPLING)
+#define SAMPLING
+
+#include <stdint.h>
+#include "packet.h"
+
+// Max 1-in-N sampling rate (packet weights are 16 bits)
+const unsigned int SAMPLING_MAX_RATE = 65535;
+
+enum sampling_mode {
+    SAMPLING_NONE,
+    SAMPLING_RANDOM,    // each packet with probability 1/rate
+    SAMPLING_FLOW       // whole flows, 1/rate of the flow hash range
+};
+
+/* Packet sampling of a capture thread
+ *
+ * Random mode doesn't draw a number per packet: the gap to the next
+ * sampled packet is drawn from the geometric distribution, so skipped
+ * packets only cost a decrement and are not even decoded.
+ *
+ * Flow mode keeps the packets whose flow hash falls in the lowest 1/rate
+ * of the hash range. The hash doesn't depend on the direction, both
+ * sides of a flow are kept or dropped together.
+ *
+ * Sampled packets are accounted with weight = rate, so the counters are
+ * unbiased estimates of the real traffic.
+ */
+class Sampler {
+  public:
+    Sampler();
+
+    // Sample 1 in rate packets. The flow hash salt must be the same for
+    // all the threads, seed should differ
+    void setup(sampling_mode mode, unsigned int rate, uint64_t salt, uint64_t seed);
+
+    sampling_mode getMode() const { return mode; }
+    unsigned int getRate() const { return rate; }
+
+    // Random mode: returns true if the next packet must be skipped
+    bool skip() {
+        if (gap > 0) {
+            gap--;
+            return true;
+        }
+        gap = nextGap();
+        return false;
+    }
+
+    // Flow mode: returns true if the flow of the packet is sampled
+    bool sampleFlow(const struct packet_info *pkt) const;
+
+  private:
+    sampling_mode mode;
+    unsigned int rate;
+
+    // Random mode: packets left to skip, xorshift state and log(1 - 1/rate)
+    uint32_t gap;
+    uint64_t state;
+    double logSkip;
+
+    // Flow mode: hashes (top 32 bits) under threshold are sampled
+    uint64_t salt;
+    uint32_t threshold;
+
+    // Draw the number of packets to skip before the next sampled one
+    uint32_t nextGap();
+
+    // Hash of one side of a flow
+    uint64_t endpoint(const struct in6_addr *addr, uint16_t port) const;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "subnets.h"
+#include "packet.h"
+#include <sys/socket.h>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+// Clear the bits of addr after the first len ones
+static void maskAddr(struct in6_addr *addr, int len) {
+    for (int i = 0; i < 16; i++) {
+        int keep = len - i * 8;
+        if (keep >= 8) continue;
+        addr->s6_addr[i] &= keep > 0 ? (0xff << (8 - keep)) & 0xff : 0;
+    }
+}
+
+// Set the count bits starting at bit from of addr to value
+static void setAddrBits(struct in6_addr *addr, int from, int count, unsigned int value) {
+    for (int i = 0; i < count; i++) {
+        int bit = from + i;
+        if (value & (1u << (count - 1 - i))) {
+            addr->s6_addr[bit / 8] |= 0x80 >> (bit % 8);
+        }
+    }
+}
+
+void SubnetLayout::addNetwork(int family, const void *addr, int len, int index) {
+    network net;
+    net.ipv4 = family != AF_INET6;
+    if (net.ipv4) {
+        in_addr_t ip;
+        memcpy(&ip, addr, 4);
+        mapIPv4(ip, &net.addr);
+        net.len = len + 96;
+    } else {
+        memcpy(&net.addr, addr, sizeof(net.addr));
+        net.len = len;
+    }
+    maskAddr(&net.addr, net.len);
+
+    if ((int) networks.size() <= index) {
+        network unset;
+        unset.len = -1;
+        networks.resize(index + 1, unset);
+    }
+    networks[index] = net;
+}
+
+void SubnetLayout::addPrefix(int family, int len) {
+    if (family == AF_INET6) prefixes6.push_back(len);
+    else                    prefixes4.push_back(len + 96);
+}
+
+bool SubnetLayout::build() {
+    sort(prefixes4.begin(), prefixes4.end());
+    sort(prefixes6.begin(), prefixes6.end());
+    prefixes4.erase(unique(prefixes4.begin(), prefixes4.end()), prefixes4.end());
+    prefixes6.erase(unique(prefixes6.begin(), prefixes6.end()), prefixes6.end());
+
+    levels.clear();
+    begin.clear();
+    addrs.clear();
+    lens.clear();
+
+    for (unsigned int n = 0; n < networks.size(); n++) {
+        begin.push_back(levels.size());
+        const network *net = &networks[n];
+        if (net->len < 0) continue;
+
+        // The network itself, then its subnets
+        vector<int> *prefixes = net->ipv4 ? &prefixes4 : &prefixes6;
+        for (int p = -1; p < (int) prefixes->size(); p++) {
+            int len = p < 0 ? net->len : (*prefixes)[p];
+            if (p >= 0 && len <= net->len) continue;
+            if (levels.size() - begin.back() == SUBNET_MAX_LEVELS) break;
+            if (len - net->len > SUBNET_MAX_BITS) {
+                cerr << "Skipping /" << (net->ipv4 ? len - 96 : len)
+                     << " rollups of internal network " << n
+                     << ", more than 2^" << SUBNET_MAX_BITS << " subnets" << endl;
+                continue;
+            }
+
+            level l;
+            l.first = addrs.size();
+            l.from = net->len;
+            l.bits = len - net->len;
+            levels.push_back(l);
+
+            for (unsigned int s = 0; s < (1u << l.bits); s++) {
+                struct in6_addr addr = net->addr;
+                setAddrBits(&addr, l.from, l.bits, s);
+                addrs.push_back(addr);
+                lens.push_back(net->ipv4 ? len - 96 : len);
+            }
+        }
+    }
+    begin.push_back(levels.size());
+
+    return !addrs.empty();
+}
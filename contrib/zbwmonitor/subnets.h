@@ -0,0 +1,114 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(SUBNETS)
+#define SUBNETS
+
+#include <netinet/in.h>
+#include <vector>
+
+using namespace std;
+
+// Max subnets of one prefix length inside an internal network (2^bits)
+const int SUBNET_MAX_BITS = 16;
+
+// Max slots of an address (the network and its subnets)
+const unsigned int SUBNET_MAX_LEVELS = 8;
+
+/* Subnet rollups layout
+ *
+ * Rollup counters are kept in a flat array: one slot per internal
+ * network, followed by a slot per subnet of each configured prefix
+ * length inside it. The slot of an address is found from the index of
+ * its internal network (the classifier lookup result) and the address
+ * bits between the network and the subnet prefixes, without hashing.
+ *
+ * Addresses are rolled up in the most specific internal network they
+ * belong to, as the classifier returns it. The layout is shared by all
+ * the stats, build it before any of them uses it.
+ */
+class SubnetLayout {
+  public:
+    // Add an internal network (addr in network byte order), same index
+    // as in the classifier
+    void addNetwork(int family, const void *addr, int len, int index);
+
+    // Roll up the networks of the given family by subnets of len bits
+    void addPrefix(int family, int len);
+
+    // Compute the slots, returns false if there are none
+    bool build();
+
+    // Number of slots
+    unsigned int size() const { return addrs.size(); }
+
+    // Subnet address (IPv4-mapped for IPv4) and prefix length of a slot
+    const struct in6_addr* getAddr(unsigned int slot) const { return &addrs[slot]; }
+    int getLength(unsigned int slot) const { return lens[slot]; }
+
+    // Store in slots (room for SUBNET_MAX_LEVELS) the rollup slots of ip,
+    // which belongs to the internal network net, returns their number
+    unsigned int lookup(int net, const struct in6_addr *ip, unsigned int *slots) const;
+
+  private:
+    struct network {
+        struct in6_addr addr;   // host bits cleared
+        int len;                // in IPv6 bits (IPv4 ones start at 96)
+        bool ipv4;
+    };
+
+    // Subnets of a network: bits [from, from + bits) of the address
+    // give the slot after first
+    struct level {
+        unsigned int first;
+        int from;
+        int bits;
+    };
+
+    vector<network> networks;   // by index (len < 0 if not set)
+    vector<int> prefixes4;
+    vector<int> prefixes6;
+
+    // Levels of network n are levels[begin[n]] to levels[begin[n + 1] - 1]
+    vector<level> levels;
+    vector<unsigned int> begin;
+
+    vector<struct in6_addr> addrs;
+    vector<unsigned char> lens;
+};
+
+// returns the count bits (up to 16) starting at bit from of addr
+inline unsigned int addrBits(const struct in6_addr *addr, int from, int count) {
+    const unsigned char *a = addr->s6_addr;
+    int b = from / 8;
+
+    unsigned int window = a[b] << 16;
+    if (b + 1 < 16) window |= a[b + 1] << 8;
+    if (b + 2 < 16) window |= a[b + 2];
+    return (window >> (24 - from % 8 - count)) & ((1u << count) - 1);
+}
+
+inline unsigned int SubnetLayout::lookup(int net, const struct in6_addr *ip, unsigned int *slots) const {
+    unsigned int n = 0;
+    for (unsigned int i = begin[net]; i < begin[net + 1]; i++) {
+        const level *l = &levels[i];
+        slots[n++] = l->first + (l->bits > 0 ? addrBits(ip, l->from, l->bits) : 0);
+    }
+    return n;
+}
+
+#endif
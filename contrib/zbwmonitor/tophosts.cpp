@@ -0,0 +1,190 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "tophosts.h"
+#include "hosttable.h"
+#include <string.h>
+
+static inline unsigned char indexTag(uint64_t hash) {
+    return 0x80 | (hash >> 57);
+}
+
+TopHosts::TopHosts(unsigned int k) {
+    if (k == 0) k = 1;
+    this->k = k;
+    count = 0;
+
+    hosts = new HostStats[k];
+    error = new unsigned long long[k];
+    weight = new unsigned long long[k];
+    heap = new uint32_t[k];
+    pos = new uint32_t[k];
+
+    // Index at most half full
+    unsigned int slots = 4;
+    while (slots < k * 2) slots <<= 1;
+    tags = new unsigned char[slots];
+    index = new uint32_t[slots];
+    memset(tags, 0, slots);
+    mask = slots - 1;
+
+    evicted = 0;
+    missed = 0;
+}
+
+TopHosts::~TopHosts() {
+    delete[] hosts;
+    delete[] error;
+    delete[] weight;
+    delete[] heap;
+    delete[] pos;
+    delete[] tags;
+    delete[] index;
+}
+
+HostStats* TopHosts::get(const struct in6_addr *ip, uint64_t hash, unsigned long long len) {
+    return add(ip, hash, len, 0);
+}
+
+HostStats* TopHosts::add(const struct in6_addr *ip, uint64_t hash,
+                         unsigned long long bytes, unsigned long long err) {
+    bool found;
+    unsigned int slot = find(ip, hash, &found);
+
+    // Known host, it only moves down in the heap
+    if (found) {
+        uint32_t e = index[slot];
+        error[e] += err;
+        weight[e] += bytes + err;
+        siftDown(pos[e]);
+        return &hosts[e];
+    }
+
+    uint32_t e;
+    unsigned long long base = 0;
+    if (count < k) {
+        e = count++;
+        heap[e] = e;
+        pos[e] = e;
+    } else {
+        // Full, replace the host with less traffic (heap top)
+        e = heap[0];
+        base = weight[e];
+        other.merge(&hosts[e]);
+        evicted++;
+        unindex(e);
+        slot = find(ip, hash, &found);
+    }
+
+    hosts[e] = HostStats(ip);
+    error[e] = base + err;
+    weight[e] = base + err + bytes;
+    tags[slot] = indexTag(hash);
+    index[slot] = e;
+
+    siftUp(pos[e]);
+    siftDown(pos[e]);
+    return &hosts[e];
+}
+
+void TopHosts::merge(TopHosts *other) {
+    for (unsigned int i = 0; i < other->count; i++) {
+        HostStats *host = &other->hosts[i];
+        unsigned long long bytes = other->weight[i] - other->error[i];
+        add(host->getIP(), HostTable::hash(host->getIP()), bytes, other->error[i])->merge(host);
+    }
+    this->other.merge(&other->other);
+    evicted += other->evicted;
+    missed += other->threshold();
+}
+
+void TopHosts::clear() {
+    count = 0;
+    memset(tags, 0, mask + 1);
+    other = HostStats();
+    evicted = 0;
+    missed = 0;
+}
+
+unsigned long long TopHosts::threshold() {
+    return missed + (count == k ? weight[heap[0]] : 0);
+}
+
+unsigned int TopHosts::find(const struct in6_addr *ip, uint64_t hash, bool *found) {
+    unsigned char tag = indexTag(hash);
+    unsigned int i = (hash >> 32) & mask;
+
+    while (tags[i] != 0) {
+        if (tags[i] == tag && sameAddr(hosts[index[i]].getIP(), ip)) {
+            *found = true;
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+    *found = false;
+    return i;
+}
+
+void TopHosts::unindex(uint32_t entry) {
+    bool found;
+    const struct in6_addr *ip = hosts[entry].getIP();
+    unsigned int i = find(ip, HostTable::hash(ip), &found);
+
+    // Backward shift deletion: move up the following entries of the
+    // probe sequence that can take the freed slot
+    unsigned int j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (tags[j] == 0) break;
+
+        unsigned int home = (HostTable::hash(hosts[index[j]].getIP()) >> 32) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            tags[i] = tags[j];
+            index[i] = index[j];
+            i = j;
+        }
+    }
+    tags[i] = 0;
+}
+
+void TopHosts::siftUp(unsigned int i) {
+    uint32_t e = heap[i];
+    while (i > 0) {
+        unsigned int parent = (i - 1) / 2;
+        if (weight[heap[parent]] <= weight[e]) break;
+        heap[i] = heap[parent];
+        pos[heap[i]] = i;
+        i = parent;
+    }
+    heap[i] = e;
+    pos[e] = i;
+}
+
+void TopHosts::siftDown(unsigned int i) {
+    uint32_t e = heap[i];
+    for (;;) {
+        unsigned int child = 2 * i + 1;
+        if (child >= count) break;
+        if (child + 1 < count && weight[heap[child + 1]] < weight[heap[child]]) child++;
+        if (weight[e] <= weight[heap[child]]) break;
+        heap[i] = heap[child];
+        pos[heap[i]] = i;
+        i = child;
+    }
+    heap[i] = e;
+    pos[e] = i;
+}
@@ -0,0 +1,114 @@
+/*
+   Copyright (C) 2011-2013 Zentyal S.L.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License, version 2, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#if !defined(TOPHOSTS)
+#define TOPHOSTS
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include "hoststats.h"
+#include "hosttable.h"
+
+/* Top-K hosts by traffic, fixed memory (Space-Saving)
+ *
+ * Only k hosts are tracked. When a new host shows up and there is no
+ * room, the host with less traffic is evicted (its counters go to the
+ * "other" bucket) and the new one takes its place, inheriting its
+ * traffic as error: counters of a host are exact since it entered the
+ * table, and it may have moved up to error bytes before.
+ *
+ * Any host not in the table moved at most threshold() bytes, so every
+ * host above that is guaranteed to be listed.
+ */
+class TopHosts {
+  public:
+    TopHosts(unsigned int k);
+    ~TopHosts();
+
+    // returns the stats for the given ip (hash from HostTable::hash),
+    // which is going to be accounted len bytes. Pointers are only valid
+    // until the next call
+    HostStats* get(const struct in6_addr *ip, uint64_t hash, unsigned long long len);
+
+    // Add the hosts of other table
+    void merge(TopHosts *other);
+
+    // Add a host which moved bytes, error bytes more at most (restored
+    // counters), returns its stats
+    HostStats* restore(const struct in6_addr *ip, unsigned long long bytes, unsigned long long err) {
+        return add(ip, HostTable::hash(ip), bytes, err);
+    }
+
+    // Remove all the hosts
+    void clear();
+
+    // Tracked hosts, entries from 0 to size() - 1 (up to capacity())
+    unsigned int size() { return count; }
+    unsigned int capacity() { return k; }
+    HostStats* at(unsigned int i) { return &hosts[i]; }
+    unsigned long long getError(unsigned int i) { return error[i]; }
+
+    // Counters of the evicted hosts and number of evictions
+    HostStats* getOther() { return &other; }
+    unsigned long long getEvicted() { return evicted; }
+
+    // Max traffic of a host not in the table
+    unsigned long long threshold();
+
+  private:
+    unsigned int k;
+    unsigned int count;
+
+    // Entries: stats, error and weight (error + traffic)
+    HostStats *hosts;
+    unsigned long long *error;
+    unsigned long long *weight;
+
+    // Min heap of entries by weight, and position of each entry in it
+    uint32_t *heap;
+    uint32_t *pos;
+
+    // Open addressing index ip -> entry
+    unsigned char *tags;
+    uint32_t *index;
+    unsigned int mask;
+
+    HostStats other;
+    unsigned long long evicted;
+
+    // Bound of the hosts missed by merged tables
+    unsigned long long missed;
+
+    // Account bytes (with the given error) to a host, evicting if needed
+    HostStats* add(const struct in6_addr *ip, uint64_t hash,
+                   unsigned long long bytes, unsigned long long err);
+
+    // returns the index slot of ip, or the empty slot where it goes
+    unsigned int find(const struct in6_addr *ip, uint64_t hash, bool *found);
+
+    // Remove the index slot of an entry
+    void unindex(uint32_t entry);
+
+    void siftUp(unsigned int i);
+    void siftDown(unsigned int i);
+
+    // Not copyable
+    TopHosts(const TopHosts&);
+    TopHosts& operator=(const TopHosts&);
+};
+
+#endif